@@ -0,0 +1,428 @@
+/*
+  bench.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Measures the parser and the output functions on a corpus of NOAA data,
+ * see gencorpus.c.
+ *
+ * usage: bench corpus
+ *
+ * Each stage runs over all reports of the corpus until BENCH_MINTIME has
+ * passed, and the fastest pass is reported. Allocations are counted by
+ * wrapping malloc() and friends at link time (-Wl,--wrap=malloc,...), so
+ * only the calls made by our own code are counted, not those made inside
+ * libc.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/metar.h"
+#include "../src/output.h"
+#include "../src/record.h"
+#include "../src/batch.h"
+#include "../src/tokenize.h"
+
+#define BENCH_MINTIME 1.0	// seconds per stage
+
+/* the corpus */
+static char *data;
+static size_t datasize;
+static noaa_rec_t *recs;
+static char **files;		// each record as a NOAA station file
+static metar_t *metars;
+static size_t nrecs;
+static size_t ntokens;
+
+static metar_ctx_t ctx;
+static FILE *devnull;
+static outbuf_t ob;
+static metar_batch_t batch;	// all of metars[]
+static volatile float sink;
+
+/* allocation counters */
+static size_t nallocs;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  nallocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  nallocs++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+  nallocs++;
+  return __real_realloc(p, size);
+}
+
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* read the corpus and split it into records */
+static void load_corpus(const char *path) {
+  const char *p, *end;
+  noaa_rec_t rec;
+  FILE *fp;
+  size_t i, size;
+
+  if ((fp = fopen(path, "rb")) == NULL) {
+    perror(path);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  datasize = ftell(fp);
+  rewind(fp);
+  data = malloc(datasize + 1);
+  if (fread(data, 1, datasize, fp) != datasize) {
+    perror(path);
+    exit(1);
+  }
+  data[datasize] = 0;
+  fclose(fp);
+
+  for (p = data, end = data + datasize;
+       (p = next_NOAA_record(p, end, 1, &rec)) != NULL; nrecs++);
+  if (nrecs == 0) {
+    fprintf(stderr, "%s: no reports\n", path);
+    exit(1);
+  }
+
+  recs = malloc(nrecs * sizeof(noaa_rec_t));
+  files = malloc(nrecs * sizeof(char *));
+  metars = malloc(nrecs * sizeof(metar_t));
+  for (p = data, i = 0; i < nrecs; i++) {
+    p = next_NOAA_record(p, end, 1, &recs[i]);
+    size = recs[i].datelen + recs[i].reportlen + 3;
+    files[i] = malloc(size);
+    snprintf(files[i], size, "%.*s\n%.*s\n", (int)recs[i].datelen,
+	     recs[i].date ? recs[i].date : "", (int)recs[i].reportlen,
+	     recs[i].report);
+    parse_Metar_n(&ctx, recs[i].report, recs[i].reportlen, &metars[i]);
+  }
+  metar_batch_init(&batch);
+  for (i = 0; i < nrecs; i++)
+    metar_batch_append(&batch, &metars[i], 0);
+
+  /* tokens as the parser sees them */
+  for (i = 0; i < nrecs; i++) {
+    for (p = recs[i].report, end = p + recs[i].reportlen; p < end; ) {
+      while (p < end && *p == ' ') p++;
+      if (p == end) break;
+      ntokens++;
+      while (p < end && *p != ' ') p++;
+    }
+  }
+}
+
+
+/* the stages, each handling all reports once */
+static void stage_split(void) {
+  const char *p = data, *end = data + datasize;
+  noaa_rec_t rec;
+
+  while ((p = next_NOAA_record(p, end, 1, &rec)) != NULL);
+}
+
+static void stage_noaa(void) {
+  noaa_t noaa;
+  size_t i;
+
+  for (i = 0; i < nrecs; i++)
+    parse_NOAA_data_r(files[i], &noaa);
+}
+
+static void stage_tokenize(void) {
+  metar_token_t tokens[TOKEN_MAX];
+  const char *p;
+  size_t i, len, used;
+  int n, done;
+
+  for (i = 0; i < nrecs; i++) {
+    for (p = recs[i].report, len = recs[i].reportlen, done = 0; !done;
+	 p += used, len -= used)
+      used = metar_tokenize(p, len, tokens, TOKEN_MAX, &n, &done);
+  }
+}
+
+static void stage_parse(void) {
+  metar_t metar;
+  size_t i;
+
+  for (i = 0; i < nrecs; i++)
+    parse_Metar_n(&ctx, recs[i].report, recs[i].reportlen, &metar);
+}
+
+static void stage_pack(void) {
+  metar_rec_t rec;
+  size_t i;
+
+  for (i = 0; i < nrecs; i++)
+    metar_pack(&metars[i], 0, &rec);
+}
+
+static void stage_batch(void) {
+  metar_batch_t b;
+
+  metar_batch_init(&b);
+  metar_batch_decode(&b, &ctx, data, datasize);
+  metar_batch_free(&b);
+}
+
+static void stage_append(void) {
+  static metar_batch_t b;
+  size_t i;
+
+  metar_batch_clear(&b);
+  for (i = 0; i < nrecs; i++)
+    metar_batch_append(&b, &metars[i], 0);
+}
+
+/* the mean temperature, from the structs and from the column */
+static void stage_scan_structs(void) {
+  float sum = 0;
+  size_t i, n = 0;
+
+  for (i = 0; i < nrecs; i++)
+    if (metars[i].found & METAR_F_TEMP) {
+      sum += metars[i].temp;
+      n++;
+    }
+  sink = sum / n;
+}
+
+static void stage_scan_column(void) {
+  const float *temp = batch.temp;
+  float sum = 0;
+  size_t i, n = 0;
+
+  for (i = 0; i < batch.count; i++)
+    if (!isnan(temp[i])) {
+      sum += temp[i];
+      n++;
+    }
+  sink = sum / n;
+}
+
+static void stage_raw(void) {
+  size_t i;
+
+  for (i = 0; i < nrecs; i++) {
+    outbuf_write(&ob, recs[i].report, recs[i].reportlen);
+    outbuf_putc(&ob, '\n');
+  }
+  outbuf_flush(&ob);
+}
+
+static void stage_brief(void) {
+  size_t i;
+
+  for (i = 0; i < nrecs; i++)
+    shortdecode_Metar(&ob, &metars[i], 0);
+  outbuf_flush(&ob);
+}
+
+static void stage_extra(void) {
+  size_t i;
+
+  for (i = 0; i < nrecs; i++)
+    shortdecode_Metar(&ob, &metars[i], 1);
+  outbuf_flush(&ob);
+}
+
+static void stage_decode(void) {
+  size_t i;
+
+  for (i = 0; i < nrecs; i++)
+    decode_Metar(&ob, &metars[i]);
+  outbuf_flush(&ob);
+}
+
+static void stage_json(void) {
+  size_t i;
+
+  for (i = 0; i < nrecs; i++) {
+    json_Metar(&ob, &metars[i]);
+    outbuf_putc(&ob, '\n');
+  }
+  outbuf_flush(&ob);
+}
+
+static void stage_csv(void) {
+  size_t i;
+
+  csv_header(&ob, METAR_F_ALL);
+  for (i = 0; i < nrecs; i++)
+    csv_Metar(&ob, &metars[i]);
+  outbuf_flush(&ob);
+}
+
+static const struct {
+  const char *name;
+  void (*run)(void);
+} stages[] = {
+  { "split", stage_split },	// next_NOAA_record()
+  { "noaa", stage_noaa },	// parse_NOAA_data_r()
+  { "pack", stage_pack },	// metar_pack()
+  { "batch", stage_batch },	// metar_batch_decode()
+  { "append", stage_append },	// metar_batch_append()
+  { "scan/structs", stage_scan_structs },	// mean temperature
+  { "scan/column", stage_scan_column },
+  { "raw", stage_raw },		// -r
+  { "brief", stage_brief },	// -b
+  { "extra", stage_extra },	// -e
+  { "decode", stage_decode },	// -d
+  { "json", stage_json },	// -o ndjson
+  { "csv", stage_csv },		// -o csv
+};
+
+
+/* run a stage over the corpus repeatedly and print the numbers of the
+   fastest pass, which is the least disturbed by anything else running */
+static void run_stage(const char *name, void (*run)(void)) {
+  double start, pass, best = 0;
+  size_t passes = 0, allocs;
+
+  allocs = nallocs;
+  start = now();
+  do {
+    pass = now();
+    run();
+    pass = now() - pass;
+    if (passes++ == 0 || pass < best) best = pass;
+  } while (now() - start < BENCH_MINTIME);
+  allocs = nallocs - allocs;
+
+  printf("%-12s %14.0f %10.1f %14.2f\n", name, nrecs / best,
+	 best * 1e9 / ntokens, (double)allocs / (nrecs * passes));
+}
+
+
+/* all tokens of a report and its parsed fields, in text */
+static void describe(size_t i, outbuf_t *text) {
+  metar_token_t tokens[TOKEN_MAX];
+  const char *p;
+  size_t len, used;
+  metar_t metar;
+  int j, n, done;
+
+  text->len = 0;
+  for (p = recs[i].report, len = recs[i].reportlen, done = 0; !done;
+       p += used, len -= used) {
+    used = metar_tokenize(p, len, tokens, TOKEN_MAX, &n, &done);
+    for (j = 0; j < n; j++)
+      outbuf_printf(text, "%zu+%u:%02x ", p - recs[i].report + tokens[j].start,
+		    tokens[j].len, tokens[j].hints);
+  }
+  parse_Metar_n(&ctx, recs[i].report, recs[i].reportlen, &metar);
+  json_Metar(text, &metar);
+}
+
+
+/* check that the tokenizer in use gives the same results as the scalar
+   one on the corpus */
+static int check_tokenizer(void) {
+  const char *name = metar_tokenize_name();
+  outbuf_t expect, got;
+  size_t i;
+  int res = 0;
+
+  outbuf_init(&expect, NULL);
+  outbuf_init(&got, NULL);
+  for (i = 0; i < nrecs && res == 0; i++) {
+    metar_tokenize_use("scalar");
+    describe(i, &expect);
+    metar_tokenize_use(name);
+    describe(i, &got);
+    if (strcmp(expect.buf, got.buf)) {
+      fprintf(stderr, "%s tokenizer differs on report %zu:\n%.*s\n"
+	      "scalar: %s\n%s: %s\n", name, i, (int)recs[i].reportlen,
+	      recs[i].report, expect.buf, name, got.buf);
+      res = 1;
+    }
+  }
+  outbuf_free(&expect);
+  outbuf_free(&got);
+  return res;
+}
+
+
+int main(int argc, char *argv[]) {
+  static const char *tokenizers[] = { "scalar", "sse2", "avx2" };
+  static const char *fields[] = { "temp", "wind", "clouds" };
+  char name[32];
+  size_t i;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s corpus\n", argv[0]);
+    return 1;
+  }
+  metar_ctx_init(&ctx);
+  load_corpus(argv[1]);
+  if ((devnull = fopen("/dev/null", "w")) == NULL) {
+    perror("/dev/null");
+    return 1;
+  }
+  outbuf_init(&ob, devnull);
+
+  printf("%s: %zu reports, %zu tokens\n", argv[1], nrecs, ntokens);
+  printf("%-12s %14s %10s %14s\n", "stage", "reports/s", "ns/token",
+	 "allocs/report");
+
+  /* each tokenizer the CPU supports, checked against the scalar one */
+  for (i = 0; i < sizeof(tokenizers) / sizeof(tokenizers[0]); i++) {
+    if (metar_tokenize_use(tokenizers[i])) continue;
+    if (check_tokenizer()) return 1;
+    snprintf(name, sizeof(name), "tok/%s", tokenizers[i]);
+    run_stage(name, stage_tokenize);	// metar_tokenize()
+    snprintf(name, sizeof(name), "parse/%s", tokenizers[i]);
+    run_stage(name, stage_parse);	// parse_Metar_n()
+  }
+  metar_tokenize_use(NULL);
+
+  /* parsing only some fields, see --fields */
+  for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    metar_fields(fields[i], &ctx.fields);
+    snprintf(name, sizeof(name), "only/%s", fields[i]);
+    run_stage(name, stage_parse);
+  }
+  ctx.fields = METAR_F_ALL;
+
+  for (i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+    run_stage(stages[i].name, stages[i].run);
+  outbuf_free(&ob);
+  fclose(devnull);
+  return 0;
+}
+
+// EOF
@@ -0,0 +1,218 @@
+/*
+  gencorpus.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Writes a synthetic corpus of METAR reports in the NOAA format, a date
+ * line followed by the report, for the benchmarks.
+ *
+ * usage: gencorpus [-n count] [-s seed] [samples...]
+ *
+ * Reports of the sample files (e.g. EFHK.TXT) are mixed in as they are, and
+ * their stations are used for the generated reports.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXSAMPLES  1024
+#define MAXSTATIONS 1024
+#define SAMPLESIZE  512
+
+static char samples[MAXSAMPLES][SAMPLESIZE];
+static int nsamples = 0;
+
+static char stations[MAXSTATIONS][5] = {
+  "EFHK", "KJFK", "EGLL", "LFPG", "EDDF", "KORD", "RJTT", "YSSY", "CYYZ",
+  "ESSA", "EFJY", "ENGM", "LEMD", "LIRF", "UUEE", "ZBAA", "OMDB", "SBGR",
+  "FAOR", "NZAA", "PANC", "KDEN", "KLAX", "PHNL"
+};
+static int nstations = 24;
+
+static const char *phenomena[] = {
+  "DZ", "RA", "SN", "SG", "PL", "GR", "GS", "UP", "BR", "FG", "FU", "VA",
+  "DU", "SA", "HZ", "PO", "SQ", "FC", "SS", "DS", "SHRA", "SHSN", "TSRA",
+  "FZDZ", "FZRA", "FZFG", "DRSN", "BLSN", "RASN", "SHRASN", "TSRAGR", "MIFG",
+  "BCFG", "PRFG", "VCSH", "VCTS", "VCFG", "RERA", "RESN"
+};
+
+static const char *clouds[] = { "FEW", "SCT", "BKN", "OVC", "VV" };
+
+static const char *vismetres[] = {
+  "9999", "8000", "6000", "5000", "4000", "3000", "2000", "1500", "1200",
+  "0800", "0500", "0300", "0100"
+};
+
+static const char *visstatute[] = {
+  "10SM", "7SM", "6SM", "5SM", "4SM", "3SM", "2SM", "1SM"
+};
+
+static const char *trends[] = {
+  "NOSIG", "BECMG 4000", "BECMG FEW020", "TEMPO 3000 -SHRA", "TEMPO BKN010",
+  "RMK AO2 SLP123 T01830139", "RMK AO2 PK WND 28035/1552"
+};
+
+#define NELEMS(a) (sizeof(a) / sizeof(a[0]))
+
+/* xorshift, so the corpus is the same everywhere for a seed */
+static uint64_t state = 88172645463325252ULL;
+
+static unsigned rnd(unsigned n) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return (unsigned)(state >> 32) % n;
+}
+
+/* true with probability percent/100 */
+static int chance(int percent) {
+  return rnd(100) < percent;
+}
+
+
+/* read the reports of a sample file, skipping NOAA date lines */
+static void read_samples(const char *path) {
+  char line[SAMPLESIZE];
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    perror(path);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), fp) && nsamples < MAXSAMPLES) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (strlen(line) < 8 || (line[4] == '/' && line[7] == '/')) continue;
+    strcpy(samples[nsamples++], line);
+
+    /* use the station of the sample */
+    if (strspn(line, "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789") != 4 ||
+	line[4] != ' ') continue;
+    for (i = 0; i < nstations; i++)
+      if (strncmp(stations[i], line, 4) == 0) break;
+    if (i == nstations && nstations < MAXSTATIONS)
+      memcpy(stations[nstations++], line, 4);
+  }
+  fclose(fp);
+}
+
+
+/* temperature group value */
+static char *temperature(char *buf, int t) {
+  if (t < 0) sprintf(buf, "M%02d", -t);
+  else sprintf(buf, "%02d", t);
+  return buf;
+}
+
+
+/* write out a generated report */
+static void generate(FILE *out) {
+  char t1[8], t2[8];
+  const char *unit, *wx;
+  unsigned level;
+  int speed, temp, i, n;
+
+  fprintf(out, "%s %02u%02u%02uZ", stations[rnd(nstations)],
+	  1 + rnd(28), rnd(24), (unsigned[]){ 0, 20, 30, 50 }[rnd(4)]);
+  if (chance(10)) fprintf(out, " AUTO");
+
+  /* wind, KT or MPS, sometimes variable or gusting */
+  unit = chance(70) ? "KT" : "MPS";
+  speed = rnd(30);
+  if (speed < 3 && chance(50)) fprintf(out, " VRB%02d", speed);
+  else fprintf(out, " %03u%02d", rnd(36) * 10, speed);
+  if (chance(20)) fprintf(out, "G%02u", speed + 5 + rnd(15));
+  fprintf(out, "%s", unit);
+  if (speed > 3 && chance(10))
+    fprintf(out, " %03uV%03u", rnd(18) * 10, 180 + rnd(18) * 10);
+
+  if (chance(15)) {
+    fprintf(out, " CAVOK");
+  } else {
+    /* visibility in metres or statute miles */
+    if (chance(75)) fprintf(out, " %s", vismetres[rnd(NELEMS(vismetres))]);
+    else fprintf(out, " %s", visstatute[rnd(NELEMS(visstatute))]);
+
+    /* phenomena, some with intensity */
+    for (i = 0, n = rnd(4); i < n; i++) {
+      wx = phenomena[rnd(NELEMS(phenomena))];
+      switch (wx[0] == 'V' ? 2 : rnd(3)) {
+      case 0: fprintf(out, " -%s", wx); break;
+      case 1: fprintf(out, " +%s", wx); break;
+      default: fprintf(out, " %s", wx); break;
+      }
+    }
+
+    /* cloud layers */
+    if (chance(10)) {
+      fprintf(out, " %s", chance(50) ? "NSC" : "SKC");
+    } else {
+      for (i = 0, n = rnd(5), level = 0; i < n; i++) {
+	level += 1 + rnd(40);
+	fprintf(out, " %s%03u", clouds[rnd(NELEMS(clouds) - (i > 0))], level);
+	if (chance(10)) fprintf(out, chance(50) ? "CB" : "TCU");
+      }
+    }
+  }
+
+  temp = (int)rnd(61) - 30;
+  fprintf(out, " %s/%s", temperature(t1, temp),
+	  temperature(t2, temp - (int)rnd(10)));
+
+  /* pressure in hPa or inches */
+  if (chance(70)) fprintf(out, " Q%04u", 960 + rnd(80));
+  else fprintf(out, " A%04u", 2880 + rnd(220));
+
+  if (chance(60)) fprintf(out, " %s", trends[rnd(NELEMS(trends))]);
+  fprintf(out, "\n");
+}
+
+
+int main(int argc, char *argv[]) {
+  long count = 100000, i;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 's':
+      state ^= strtoull(optarg, NULL, 10) * 0x9e3779b97f4a7c15ULL;
+      if (state == 0) state = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n count] [-s seed] [samples...]\n",
+	      argv[0]);
+      return 1;
+    }
+  }
+  for (c = optind; c < argc; c++) read_samples(argv[c]);
+
+  for (i = 0; i < count; i++) {
+    printf("2017/07/%02u %02u:%02u\n", 1 + rnd(28), rnd(24), rnd(60));
+    if (nsamples && chance(5)) printf("%s\n", samples[rnd(nsamples)]);
+    else generate(stdout);
+  }
+  return 0;
+}
+
+// EOF
@@ -0,0 +1,235 @@
+/*
+  batch.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metar.h"
+#include "record.h"
+#include "batch.h"
+
+/* unit conversions */
+#define KT_MS    0.514444
+#define KMH_MS   (1 / 3.6)
+#define SM_M     1609.344
+#define INHG_HPA 33.8639
+
+/* first capacity of the columns and the side arrays */
+#define BATCH_MINCAP 64
+
+
+/* grow an array to hold need elements, doubling; returns 1 if out of
+ * memory, leaving it as it was */
+static int grow(void *array, size_t *cap, size_t need, size_t size) {
+  size_t n = *cap ? *cap : BATCH_MINCAP;
+  void *p;
+
+  if (need <= *cap) return 0;
+  while (n < need) n *= 2;
+  if ((p = realloc(*(void **)array, n * size)) == NULL) return 1;
+  *(void **)array = p;
+  *cap = n;
+  return 0;
+}
+
+
+/* grow every column to hold need reports */
+static int grow_columns(metar_batch_t *batch, size_t need) {
+  size_t n = batch->capacity ? batch->capacity : BATCH_MINCAP, cap;
+
+  if (need <= batch->capacity) return 0;
+  while (n < need) n *= 2;
+#define COLUMN(c, extra) \
+  cap = batch->capacity + extra; \
+  if (grow(&batch->c, &cap, n + extra, sizeof(*batch->c))) return 1;
+  COLUMN(station, 0);
+  COLUMN(obstime, 0);
+  COLUMN(winddir, 0);
+  COLUMN(windspeed, 0);
+  COLUMN(windgust, 0);
+  COLUMN(vis, 0);
+  COLUMN(qnh, 0);
+  COLUMN(temp, 0);
+  COLUMN(dewpoint, 0);
+  COLUMN(flags, 0);
+  COLUMN(cloudoff, 1);
+  COLUMN(wxoff, 1);
+#undef COLUMN
+  batch->capacity = n;
+  return 0;
+}
+
+
+/* a wind speed in m/s */
+static float wind_ms(float speed, const char *unit) {
+  if (strcmp(unit, "m/s") == 0 || strcmp(unit, "MPS") == 0) return speed;
+  if (strcmp(unit, "KT") == 0) return speed * KT_MS;
+  if (strcmp(unit, "KMH") == 0) return speed * KMH_MS;
+  return NAN;
+}
+
+
+/* PUBLIC--
+ * Set up an empty batch.
+ */
+void metar_batch_init(metar_batch_t *batch) {
+  memset(batch, 0x0, sizeof(metar_batch_t));
+} // metar_batch_init
+
+
+/* PUBLIC--
+ * Empty the batch, keeping its memory.
+ */
+void metar_batch_clear(metar_batch_t *batch) {
+  batch->count = 0;
+  batch->nclouds = 0;
+  batch->nwx = 0;
+} // metar_batch_clear
+
+
+/* PUBLIC--
+ * Release the memory of the batch.
+ */
+void metar_batch_free(metar_batch_t *batch) {
+  free(batch->station);
+  free(batch->obstime);
+  free(batch->winddir);
+  free(batch->windspeed);
+  free(batch->windgust);
+  free(batch->vis);
+  free(batch->qnh);
+  free(batch->temp);
+  free(batch->dewpoint);
+  free(batch->flags);
+  free(batch->cloudoff);
+  free(batch->wxoff);
+  free(batch->clouds);
+  free(batch->wx);
+  metar_batch_init(batch);
+} // metar_batch_free
+
+
+/* PUBLIC--
+ * Append a decoded report to the columns.
+ */
+int metar_batch_append(metar_batch_t *batch, const metar_t *metar,
+		       time_t obstime) {
+  size_t i = batch->count;
+  unsigned int found = metar->found & ~metar->omitted;
+  float fp;
+  int j;
+
+  if (grow_columns(batch, i + 1) ||
+      grow(&batch->clouds, &batch->cloudcap, batch->nclouds + metar->nclouds,
+	   sizeof(cloud_t)) ||
+      grow(&batch->wx, &batch->wxcap, batch->nwx + metar->nobs,
+	   sizeof(metar_obs_t)))
+    return 1;
+
+  batch->station[i] = (uint32_t)(unsigned char)metar->station[0] << 24 |
+    (uint32_t)(unsigned char)metar->station[1] << 16 |
+    (uint32_t)(unsigned char)metar->station[2] << 8 |
+    (uint32_t)(unsigned char)metar->station[3];
+  batch->obstime[i] = obstime;
+  batch->flags[i] = 0;
+
+  if (found & METAR_F_WIND) {
+    if (metar->winddir == -1) batch->flags[i] |= BATCH_VRB;
+    batch->winddir[i] = (metar->winddir == -1) ? NAN : metar->winddir;
+    batch->windspeed[i] = wind_ms(metar->windstr, metar->windunit);
+    batch->windgust[i] = wind_ms(metar->windgust, metar->windunit);
+  } else {
+    batch->winddir[i] = batch->windspeed[i] = batch->windgust[i] = NAN;
+  }
+
+  if (!(found & METAR_F_VIS)) {
+    batch->vis[i] = NAN;
+  } else if (metar->vis == -1) {
+    batch->flags[i] |= BATCH_VISMAX;
+    batch->vis[i] = BATCH_VISMAXM;
+  } else {
+    batch->vis[i] = strcmp(metar->visunit, "SM") == 0 ?
+      metar->vis * SM_M : metar->vis;
+  }
+
+  if (found & METAR_F_QNH) {
+    for (fp = metar->qnh, j = 0; j < metar->qnhfp; j++) fp /= 10;
+    batch->qnh[i] = strcmp(metar->qnhunit, "inHg") == 0 ?
+      fp * INHG_HPA : fp;
+  } else {
+    batch->qnh[i] = NAN;
+  }
+
+  if (found & METAR_F_TEMP) {
+    batch->temp[i] = metar->temp;
+    batch->dewpoint[i] = metar->dewp;
+  } else {
+    batch->temp[i] = batch->dewpoint[i] = NAN;
+  }
+
+  for (j = 0; j < metar->nstuff; j++) {
+    if (strcmp(metar->stuff[j], METAR_CAVOK) == 0)
+      batch->flags[i] |= BATCH_CAVOK;
+    else if (strcmp(metar->stuff[j], METAR_NOSIG) == 0)
+      batch->flags[i] |= BATCH_NOSIG;
+    else if (strcmp(metar->stuff[j], METAR_SNOCLO) == 0)
+      batch->flags[i] |= BATCH_SNOCLO;
+  }
+
+  /* the side arrays */
+  batch->cloudoff[i] = batch->nclouds;
+  memcpy(batch->clouds + batch->nclouds, metar->clouds,
+	 metar->nclouds * sizeof(cloud_t));
+  batch->nclouds += metar->nclouds;
+  batch->cloudoff[i + 1] = batch->nclouds;
+  batch->wxoff[i] = batch->nwx;
+  memcpy(batch->wx + batch->nwx, metar->obs,
+	 metar->nobs * sizeof(metar_obs_t));
+  batch->nwx += metar->nobs;
+  batch->wxoff[i + 1] = batch->nwx;
+
+  batch->count++;
+  return 0;
+} // metar_batch_append
+
+
+/* PUBLIC--
+ * Decode NOAA data into the batch.
+ */
+size_t metar_batch_decode(metar_batch_t *batch, const metar_ctx_t *ctx,
+			  const char *data, size_t len) {
+  const char *p = data, *end = data + len;
+  time_t now = time(NULL);
+  noaa_rec_t rec;
+  metar_t metar;
+  size_t n = 0;
+
+  while ((p = next_NOAA_record(p, end, 1, &rec)) != NULL) {
+    parse_Metar_n(ctx, rec.report, rec.reportlen, &metar);
+    if (metar_batch_append(batch, &metar,
+			   metar_obstime(rec.date, rec.datelen, &metar, now)))
+      break;
+    n++;
+  }
+  return n;
+} // metar_batch_decode
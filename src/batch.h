@@ -0,0 +1,81 @@
+/*
+  batch.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Reports decoded into columns, for analysing many of them at once. Each
+ * single field is a contiguous array with an element per report, in the
+ * same units whatever the report used, and NAN where the report has no
+ * such group or the field wasn't decoded, so a column can be scanned
+ * without looking at the others. The cloud layers and weather groups of
+ * report i are clouds[cloudoff[i]] up to clouds[cloudoff[i + 1]] and
+ * wx[wxoff[i]] up to wx[wxoff[i + 1]].
+ *
+ * Needs <stdint.h>, <time.h> and metar.h.
+ */
+
+/* flags of a report */
+#define BATCH_VRB    0x01	// variable wind direction
+#define BATCH_VISMAX 0x02	// visibility 10 km or more
+#define BATCH_CAVOK  0x04
+#define BATCH_NOSIG  0x08
+#define BATCH_SNOCLO 0x10
+
+/* visibility given for 10 km or more */
+#define BATCH_VISMAXM 10000
+
+typedef struct {
+  size_t    count;	// reports
+  uint32_t *station;	// ICAO code, first letter in the high byte
+  int64_t  *obstime;	// observation time, seconds since the epoch
+  float    *winddir;	// degrees, NAN when variable
+  float    *windspeed;	// m/s
+  float    *windgust;	// m/s, the speed when not gusting
+  float    *vis;	// metres
+  float    *qnh;	// hPa
+  float    *temp;	// degrees C
+  float    *dewpoint;	// degrees C
+  uint8_t  *flags;	// BATCH_*
+  uint32_t *cloudoff;	// count + 1 offsets into clouds
+  uint32_t *wxoff;	// count + 1 offsets into wx
+  cloud_t  *clouds;
+  metar_obs_t *wx;
+  size_t    capacity, nclouds, cloudcap, nwx, wxcap;	// internal
+} metar_batch_t;
+
+/* Set up an empty batch. */
+void metar_batch_init(metar_batch_t *batch);
+
+/* Empty the batch, keeping its memory for reuse. */
+void metar_batch_clear(metar_batch_t *batch);
+
+/* Release the memory of the batch. */
+void metar_batch_free(metar_batch_t *batch);
+
+/* Append a decoded report observed at obstime. Returns 1 if out of
+ * memory, leaving the batch as it was. */
+int metar_batch_append(metar_batch_t *batch, const metar_t *metar,
+		       time_t obstime);
+
+/* Decode the NOAA data of len bytes, one or more date and report records,
+ * and append the reports. A report's observation time is taken from its
+ * date line, or from its day and time. Returns the number of reports
+ * appended, which falls short if memory runs out. */
+size_t metar_batch_decode(metar_batch_t *batch, const metar_ctx_t *ctx,
+			  const char *data, size_t len);
@@ -0,0 +1,439 @@
+/*
+  bulk.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "metar.h"
+#include "output.h"
+#include "bulk.h"
+#include "stats.h"
+
+
+/* hand all records between p and end over to the callback, returns the
+ * start of the incomplete record left at the end */
+static const char *split_records(const char *p, const char *end, int eof,
+				 bulk_cb cb, void *arg) {
+  const char *next;
+  noaa_rec_t rec;
+  uint64_t start = stats_start();
+
+  while ((next = next_NOAA_record(p, end, eof, &rec)) != NULL) {
+    stats_stop(STAT_SPLIT, start);
+    cb(&rec, arg);
+    p = next;
+    start = stats_start();
+  }
+  return p;
+}
+
+
+/* split a mapped input window by window, releasing the pages already
+ * decoded so that resident memory stays flat */
+static void map_records(char *data, size_t size, bulk_cb cb, void *arg) {
+  const char *p = data, *end = data + size, *window, *rest;
+  size_t pagesize = sysconf(_SC_PAGESIZE), done;
+
+  madvise(data, size, MADV_SEQUENTIAL);
+  while (p < end) {
+    window = (end - p > BULK_BLOCKSIZE) ? p + BULK_BLOCKSIZE : end;
+    rest = split_records(p, window, window == end, cb, arg);
+    /* a record longer than a window takes the rest of the input */
+    if (rest == p && window != end)
+      rest = split_records(p, window = end, 1, cb, arg);
+    if (window == end) break;
+    p = rest;
+
+    done = (p - data) / pagesize * pagesize;
+    if (done) madvise(data, done, MADV_DONTNEED);
+  }
+}
+
+
+/* read the input in blocks, carrying incomplete records over */
+static int read_records(int fd, bulk_cb cb, void *arg) {
+  size_t size = BULK_BLOCKSIZE, len = 0;
+  const char *rest;
+  char *buf, *tmp;
+  ssize_t n;
+
+  if ((buf = malloc(size)) == NULL) return 1;
+
+  for (;;) {
+    /* a record longer than the buffer makes it grow */
+    if (len == size) {
+      if ((tmp = realloc(buf, size * 2)) == NULL) break;
+      buf = tmp;
+      size *= 2;
+    }
+
+    n = read(fd, buf + len, size - len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      split_records(buf, buf + len, 1, cb, arg);
+      free(buf);
+      return n < 0;
+    }
+    len += n;
+
+    rest = split_records(buf, buf + len, 0, cb, arg);
+    len -= rest - buf;
+    memmove(buf, rest, len);
+  }
+
+  free(buf);
+  return 1;
+}
+
+
+/* split the input open on fd into records */
+static int fd_records(int fd, const char *path, bulk_cb cb, void *arg) {
+  struct stat st;
+  char *data;
+  int res;
+
+  /* map regular files, read anything else */
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+      != MAP_FAILED) {
+    map_records(data, st.st_size, cb, arg);
+    munmap(data, st.st_size);
+    res = 0;
+  } else {
+    res = read_records(fd, cb, arg);
+    if (res) perror(path);
+  }
+  return res;
+}
+
+
+/* open the file, or standard input if path is "-"; -1 if it can't be */
+static int open_input(const char *path) {
+  int fd;
+
+  if (strcmp(path, "-") == 0) return STDIN_FILENO;
+  if ((fd = open(path, O_RDONLY)) < 0) perror(path);
+  return fd;
+}
+
+
+/* PUBLIC--
+ * Split the NOAA data in the file (or standard input if path is "-") into
+ * records and hand them over to the callback.
+ */
+int bulk_Metars(const char *path, bulk_cb cb, void *arg) {
+  int fd, res;
+
+  if ((fd = open_input(path)) < 0) return 1;
+  res = fd_records(fd, path, cb, arg);
+  if (fd != STDIN_FILENO) close(fd);
+  return res;
+} // bulk_Metars
+
+
+static void out_init(bulk_out_t *out) {
+  outbuf_init(&out->text, NULL);
+  outbuf_init(&out->data, NULL);
+  out->count = 0;
+  out->mark = (size_t)-1;
+}
+
+
+/* serial decoding, each record is merged as soon as it's decoded */
+typedef struct {
+  bulk_decode_cb decode;
+  bulk_merge_cb  merge;
+  void          *arg;
+  bulk_out_t     out;
+} serial_t;
+
+static void serial_record(const noaa_rec_t *rec, void *arg) {
+  serial_t *serial = arg;
+  bulk_out_t *out = &serial->out;
+
+  serial->decode(rec, out, serial->arg);
+  serial->merge(out, serial->arg);
+  out->text.len = out->data.len = 0;
+  out->text.buf[0] = out->data.buf[0] = 0;
+  out->count = 0;
+  out->mark = (size_t)-1;
+}
+
+
+/* The chunks a thread has left: chunk id + j * nthreads for j in [lo, hi),
+ * packed as lo << 32 | hi so that the owner taking from the front and the
+ * thieves taking from the back agree with a single compare-and-swap. Each
+ * one is on a cache line of its own. */
+typedef struct {
+  uint64_t range;
+  char     pad[64 - sizeof(uint64_t)];
+} deque_t;
+
+/* the state shared by the decoding threads and the merging caller */
+typedef struct {
+  const char     *data;
+  size_t         *bounds;	// chunk i is bounds[i] to bounds[i + 1]
+  int             nchunks;
+  int             nthreads;
+  deque_t        *deques;
+  bulk_out_t     *outs;
+  unsigned char  *done;		// set under lock when a chunk is decoded
+  int             merged;	// chunks merged so far, under lock
+  int             ahead;	// max chunks taken but not merged
+  int             go;		// set under lock once the shares are dealt
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;		// a chunk decoded or merged, or go
+  bulk_decode_cb  decode;
+  void           *arg;
+} parallel_t;
+
+typedef struct {
+  parallel_t *par;
+  int         id;
+} worker_t;
+
+/* a record of the chunk being decoded */
+typedef struct {
+  parallel_t *par;
+  bulk_out_t *out;
+} chunk_t;
+
+
+/* the end of the chunk starting at p: the start of the first line after
+ * BULK_CHUNKSIZE bytes which follows a report, as a date line belongs to
+ * the report after it */
+static const char *chunk_end(const char *p, const char *end) {
+  const char *line, *eol;
+  noaa_rec_t rec;
+
+  if (end - p <= BULK_CHUNKSIZE) return end;
+  /* on to the start of a line */
+  if ((eol = memchr(p + BULK_CHUNKSIZE, '\n', end - p - BULK_CHUNKSIZE))
+      == NULL) return end;
+  for (line = eol + 1; line < end; line = eol + 1) {
+    if ((eol = memchr(line, '\n', end - line)) == NULL) break;
+    if (next_NOAA_record(line, eol + 1, 1, &rec) == eol + 1) return eol + 1;
+  }
+  return end;
+}
+
+
+/* take a chunk off the front or the back of the thread's share, -1 if
+ * there are none left */
+static int take_chunk(parallel_t *par, int id, int front) {
+  deque_t *deque = &par->deques[id];
+  uint64_t range, next;
+  uint32_t lo, hi;
+
+  range = __atomic_load_n(&deque->range, __ATOMIC_ACQUIRE);
+  do {
+    lo = range >> 32;
+    hi = (uint32_t)range;
+    if (lo >= hi) return -1;
+    next = front ? ((uint64_t)(lo + 1) << 32 | hi)
+		 : ((uint64_t)lo << 32 | (hi - 1));
+  } while (!__atomic_compare_exchange_n(&deque->range, &range, next, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return id + (int)(front ? lo : hi - 1) * par->nthreads;
+}
+
+
+static void chunk_record(const noaa_rec_t *rec, void *arg) {
+  chunk_t *chunk = arg;
+
+  chunk->par->decode(rec, chunk->out, chunk->par->arg);
+}
+
+
+/* decode the chunk into its output and tell the caller it's done */
+static void decode_chunk(parallel_t *par, int i) {
+  chunk_t chunk = { par, &par->outs[i] };
+
+  out_init(chunk.out);
+  split_records(par->data + par->bounds[i], par->data + par->bounds[i + 1],
+		1, chunk_record, &chunk);
+
+  pthread_mutex_lock(&par->lock);
+  par->done[i] = 1;
+  pthread_cond_broadcast(&par->cond);
+  pthread_mutex_unlock(&par->lock);
+}
+
+
+/* decode the thread's own chunks in order, then steal from the others
+ * until none are left; a chunk too far ahead of the merge waits for it.
+ * This can't deadlock: the next chunk to merge is either taken, and never
+ * waits, or at the front of a share whose owner has only taken chunks
+ * from its own front, which are all merged. */
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  parallel_t *par = w->par;
+  int i, chunk;
+
+  pthread_mutex_lock(&par->lock);
+  while (!par->go) pthread_cond_wait(&par->cond, &par->lock);
+  pthread_mutex_unlock(&par->lock);
+
+  for (;;) {
+    chunk = take_chunk(par, w->id, 1);
+    for (i = 1; chunk < 0 && i < par->nthreads; i++)
+      chunk = take_chunk(par, (w->id + i) % par->nthreads, 0);
+    if (chunk < 0) return NULL;
+
+    pthread_mutex_lock(&par->lock);
+    while (chunk - par->merged >= par->ahead)
+      pthread_cond_wait(&par->cond, &par->lock);
+    pthread_mutex_unlock(&par->lock);
+    decode_chunk(par, chunk);
+  }
+}
+
+
+/* decode the mapped input on nthreads threads, merging the chunks in
+ * order on this one */
+static int map_parallel(const char *data, size_t size, int nthreads,
+			bulk_decode_cb decode, bulk_merge_cb merge,
+			void *arg) {
+  parallel_t par;
+  worker_t *workers;
+  pthread_t *threads;
+  const char *p, *end = data + size;
+  size_t pagesize = sysconf(_SC_PAGESIZE), released = 0, done;
+  int i, started = 0;
+
+  memset(&par, 0x0, sizeof(par));
+  par.data = data;
+  par.decode = decode;
+  par.arg = arg;
+
+  /* cut the input into chunks at record boundaries */
+  par.bounds = malloc((size / BULK_CHUNKSIZE + 2) * sizeof(size_t));
+  for (p = data; p < end; p = chunk_end(p, end))
+    par.bounds[par.nchunks++] = p - data;
+  par.bounds[par.nchunks] = size;
+
+  par.nthreads = (nthreads < par.nchunks) ? nthreads : par.nchunks;
+  par.deques = aligned_alloc(sizeof(deque_t),
+			     par.nthreads * sizeof(deque_t));
+  par.outs = malloc(par.nchunks * sizeof(bulk_out_t));
+  par.done = calloc(par.nchunks, 1);
+  workers = malloc(par.nthreads * sizeof(worker_t));
+  threads = malloc(par.nthreads * sizeof(pthread_t));
+  pthread_mutex_init(&par.lock, NULL);
+  pthread_cond_init(&par.cond, NULL);
+
+  /* the chunks are dealt to the threads which could be started, and if
+     none could, they are all decoded here before being merged */
+  for (i = 0; i < par.nthreads; i++) {
+    workers[started].par = &par;
+    workers[started].id = started;
+    if (pthread_create(&threads[started], NULL, worker, &workers[started])
+	== 0) started++;
+  }
+  pthread_mutex_lock(&par.lock);
+  par.nthreads = started ? started : 1;
+  par.ahead = started ? BULK_AHEAD * started : par.nchunks;
+  for (i = 0; i < par.nthreads; i++)
+    par.deques[i].range = (par.nchunks - i + par.nthreads - 1) / par.nthreads;
+  par.go = 1;
+  pthread_cond_broadcast(&par.cond);
+  pthread_mutex_unlock(&par.lock);
+  if (started == 0) {
+    workers[0].par = &par;
+    workers[0].id = 0;
+    worker(&workers[0]);
+  }
+
+  /* hand the outputs over in order as soon as they are ready, letting the
+     threads on and releasing the pages merged */
+  for (i = 0; i < par.nchunks; i++) {
+    pthread_mutex_lock(&par.lock);
+    while (!par.done[i]) pthread_cond_wait(&par.cond, &par.lock);
+    pthread_mutex_unlock(&par.lock);
+    merge(&par.outs[i], arg);
+    outbuf_free(&par.outs[i].text);
+    outbuf_free(&par.outs[i].data);
+
+    pthread_mutex_lock(&par.lock);
+    par.merged = i + 1;
+    pthread_cond_broadcast(&par.cond);
+    pthread_mutex_unlock(&par.lock);
+    done = par.bounds[i + 1] / pagesize * pagesize;
+    if (done > released) {
+      madvise((char *)data + released, done - released, MADV_DONTNEED);
+      released = done;
+    }
+  }
+
+  for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  pthread_cond_destroy(&par.cond);
+  pthread_mutex_destroy(&par.lock);
+  free(threads);
+  free(workers);
+  free(par.done);
+  free(par.outs);
+  free(par.deques);
+  free(par.bounds);
+  return 0;
+}
+
+
+/* PUBLIC--
+ * Split the NOAA data in the file into chunks, decode them on nthreads
+ * threads and merge the outputs in order.
+ */
+int bulk_Metars_parallel(const char *path, int nthreads,
+			 bulk_decode_cb decode, bulk_merge_cb merge,
+			 void *arg) {
+  serial_t serial = { decode, merge, arg };
+  struct stat st;
+  char *data;
+  int fd, res;
+
+  if ((fd = open_input(path)) < 0) return 1;
+  if (nthreads > BULK_MAXTHREADS) nthreads = BULK_MAXTHREADS;
+
+  /* small inputs aren't worth the threads */
+  if (nthreads > 1 && fd != STDIN_FILENO && fstat(fd, &st) == 0 &&
+      S_ISREG(st.st_mode) && st.st_size > BULK_CHUNKSIZE &&
+      (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+      != MAP_FAILED) {
+    res = map_parallel(data, st.st_size, nthreads, decode, merge, arg);
+    munmap(data, st.st_size);
+  } else {
+    out_init(&serial.out);
+    res = fd_records(fd, path, serial_record, &serial);
+    outbuf_free(&serial.out.text);
+    outbuf_free(&serial.out.data);
+  }
+
+  if (fd != STDIN_FILENO) close(fd);
+  return res;
+} // bulk_Metars_parallel
+
+// EOF
@@ -0,0 +1,77 @@
+/*
+  bulk.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* size of the blocks read from inputs which can't be memory-mapped */
+#define BULK_BLOCKSIZE (1024 * 1024)
+
+/* size of the chunks decoded by the threads of bulk_Metars_parallel() */
+#define BULK_CHUNKSIZE (256 * 1024)
+
+/* chunks per thread which may be decoded ahead of the merge */
+#define BULK_AHEAD 2
+
+/* max number of decoding threads */
+#define BULK_MAXTHREADS 256
+
+/* called for each record of the input */
+typedef void (*bulk_cb)(const noaa_rec_t *rec, void *arg);
+
+/* Split the NOAA data in the file, or standard input if path is "-", into
+ * records and hand them to the callback in input order. Regular files are
+ * memory-mapped, other inputs are read in blocks, so memory use does not
+ * grow with the size of the input. Returns 1 if the input can't be read.
+ */
+int bulk_Metars(const char *path, bulk_cb cb, void *arg);
+
+/* the output of a chunk of the input, collected by a decoding thread until
+ * its turn comes to be written out */
+typedef struct {
+  outbuf_t text;	// formatted reports
+  outbuf_t data;	// anything else, eg. history records
+  size_t   count;	// free for the callbacks
+  size_t   mark;	// free for the callbacks, (size_t)-1 at first
+} bulk_out_t;
+
+/* called on a decoding thread for each record of a chunk */
+typedef void (*bulk_decode_cb)(const noaa_rec_t *rec, bulk_out_t *out,
+			       void *arg);
+
+/* called on the calling thread with the output of each chunk, in input
+ * order; the output is discarded when it returns */
+typedef void (*bulk_merge_cb)(bulk_out_t *out, void *arg);
+
+/* As bulk_Metars(), decoding a regular file on nthreads threads. The file
+ * is memory-mapped and cut into chunks of about BULK_CHUNKSIZE bytes at
+ * record boundaries. Each thread owns every nthreads'th chunk and takes
+ * them in order, and a thread out of chunks steals the last ones left to
+ * the others, so the threads stay busy to the end however unevenly the
+ * chunks decode. The decode callback formats the records of a chunk into
+ * its own output, and the merge callback gets the outputs in input order
+ * as soon as they are ready, so the result is the same as decoding
+ * serially. The threads get at most BULK_AHEAD * nthreads chunks ahead of
+ * the merge, and the pages merged are released, so memory use stays flat
+ * however large the file and however slow the merge. Other inputs, and a
+ * single thread, are decoded serially with decode and merge per record.
+ * Returns 1 if the input can't be read.
+ */
+int bulk_Metars_parallel(const char *path, int nthreads,
+			 bulk_decode_cb decode, bulk_merge_cb merge,
+			 void *arg);
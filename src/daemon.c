@@ -0,0 +1,406 @@
+/*
+  daemon.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metar.h"
+#include "fetch.h"
+#include "output.h"
+#include "record.h"
+#include "schedule.h"
+#include "daemon.h"
+#include "stats.h"
+
+extern int verbose;
+
+/* latest report of a station, rendered in each output format */
+typedef struct {
+  char   station[10];
+  char  *raw;
+  char  *brief;
+  char  *full;
+  char  *json;
+  time_t updated;
+  sched_t sched;	// used by the refresh thread only
+} entry_t;
+
+/* a connected client, its partial query and the answers not sent yet */
+typedef struct {
+  int      fd;
+  size_t   len;
+  char     query[128];
+  outbuf_t out;
+  size_t   sent;	// bytes of out sent so far
+  int      eof;		// no more queries, close once out is sent
+} client_t;
+
+static entry_t *entries;
+static int nentries;
+static pthread_rwlock_t entrylock = PTHREAD_RWLOCK_INITIALIZER;
+static volatile sig_atomic_t stop;
+
+
+static void handle_stop(int sig) {
+  stop = 1;
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const entry_t *)a)->station, ((const entry_t *)b)->station);
+}
+
+
+/* find the entry of a station; the entries are sorted */
+static entry_t *find_entry(const char *station) {
+  entry_t key;
+
+  memset(&key, 0x0, sizeof(key));
+  strncpy(key.station, station, sizeof(key.station) - 1);
+  return bsearch(&key, entries, nentries, sizeof(entry_t), compare_entries);
+}
+
+
+/* render a report newer than the stored one as soon as it has been
+ * received and swap it into the entry of its station; runs on the refresh
+ * thread, which alone touches the schedules */
+static void store_report(fetch_t *fetch, const noaa_rec_t *rec, void *arg) {
+  const daemon_opts_t *opts = arg;
+  outbuf_t raw, brief, full, json;
+  entry_t *entry;
+  metar_t metar;
+  uint64_t start;
+  time_t now, obs;
+  char *tmp;
+
+  stats_count(STAT_REPORTS, 1);
+  if ((entry = find_entry(fetch->station)) == NULL) return;
+  start = stats_start();
+  parse_Metar_n(opts->ctx, rec->report, rec->reportlen, &metar);
+  stats_stop(STAT_PARSE, start);
+
+  /* older reports, and the same one polled again, are left out; a
+     correction of the latest one is taken */
+  now = time(NULL);
+  obs = metar_obstime(NULL, 0, &metar, now);
+  if (entry->raw && (obs < entry->sched.obs ||
+		     (obs == entry->sched.obs &&
+		      strncmp(entry->raw, rec->report, rec->reportlen) == 0 &&
+		      entry->raw[rec->reportlen] == '\n')))
+    return;
+  sched_report(&entry->sched, obs, now);
+
+  start = stats_start();
+
+  outbuf_init(&raw, NULL);
+  outbuf_write(&raw, rec->report, rec->reportlen);
+  outbuf_putc(&raw, '\n');
+  outbuf_init(&brief, NULL);
+  shortdecode_Metar(&brief, &metar, opts->extra);
+  outbuf_init(&full, NULL);
+  decode_Metar(&full, &metar);
+  outbuf_init(&json, NULL);
+  json_Metar(&json, &metar);
+  outbuf_putc(&json, '\n');
+  stats_stop(STAT_OUTPUT, start);
+
+  /* hand the old renderings over for freeing below */
+  pthread_rwlock_wrlock(&entrylock);
+  tmp = entry->raw; entry->raw = raw.buf; raw.buf = tmp;
+  tmp = entry->brief; entry->brief = brief.buf; brief.buf = tmp;
+  tmp = entry->full; entry->full = full.buf; full.buf = tmp;
+  tmp = entry->json; entry->json = json.buf; json.buf = tmp;
+  entry->updated = now;
+  pthread_rwlock_unlock(&entrylock);
+
+  outbuf_free(&raw);
+  outbuf_free(&brief);
+  outbuf_free(&full);
+  outbuf_free(&json);
+}
+
+
+/* background thread refreshing the stations, all of them every interval
+ * or each one when its schedule says */
+static void *refresh_reports(void *arg) {
+  const daemon_opts_t *opts = arg;
+  fetch_opts_t fopts = *opts->fetch;
+  fetch_t *fetches;
+  sched_t *sched;
+  time_t now, wake;
+  int *polled;
+  int i, n, fresh;
+
+  /* the order of the stations doesn't matter here */
+  fopts.record = store_report;
+  fetches = calloc(nentries, sizeof(fetch_t));
+  polled = calloc(nentries, sizeof(int));
+  now = time(NULL);
+  for (i = 0; i < nentries; i++)
+    sched_init(&entries[i].sched, entries[i].station, now);
+
+  while (!stop) {
+    now = time(NULL);
+    wake = now + opts->interval;
+    for (i = n = 0; i < nentries; i++) {
+      sched = &entries[i].sched;
+      if (opts->adaptive && sched->next > now) {
+	if (sched->next < wake) wake = sched->next;
+	continue;
+      }
+      memset(&fetches[n], 0x0, sizeof(fetch_t));
+      strcpy(fetches[n].station, entries[i].station);
+      polled[n++] = i;
+    }
+
+    if (n) {
+      fetch_Metars(fetches, n, &fopts, NULL, arg);
+      now = time(NULL);
+      for (i = fresh = 0; i < n; i++) {
+	sched = &entries[polled[i]].sched;
+	fresh += sched->fresh;
+	sched_polled(sched, now, opts->interval);
+      }
+      stats_count(STAT_POLLS, n);
+      stats_count(STAT_UNCHANGED, n - fresh);
+      if (verbose)
+	printf("Refreshed %d stations, %d with new reports\n", n, fresh);
+      /* the next ones may be due already */
+      if (opts->adaptive) continue;
+      wake = now + opts->interval;
+    }
+
+    while (time(NULL) < wake && !stop)
+      sleep(1);
+  }
+  free(polled);
+  free(fetches);
+  return NULL;
+}
+
+
+/* answer one query line into the client's output */
+static void answer_query(client_t *client, char *query) {
+  char *station, *mode, *text = NULL;
+  const char *err = NULL;
+  entry_t *entry;
+  char *p;
+
+  for (p = query; *p; p++) *p = toupper((unsigned char)*p);
+  station = strtok_r(query, " \t\r", &p);
+  mode = strtok_r(NULL, " \t\r", &p);
+  if (station == NULL) return;
+
+  /* statistics in the Prometheus text format */
+  if (strcmp(station, "METRICS") == 0) {
+    stats_prometheus(&client->out);
+    outbuf_putc(&client->out, '\n');
+    return;
+  }
+
+  pthread_rwlock_rdlock(&entrylock);
+  if ((entry = find_entry(station)) == NULL) {
+    err = "ERR unknown station\n\n";
+  } else if (mode == NULL || strcmp(mode, "BRIEF") == 0) {
+    text = entry->brief;
+  } else if (strcmp(mode, "FULL") == 0) {
+    text = entry->full;
+  } else if (strcmp(mode, "RAW") == 0) {
+    text = entry->raw;
+  } else if (strcmp(mode, "JSON") == 0) {
+    text = entry->json;
+  } else {
+    err = "ERR unknown format\n\n";
+  }
+  if (entry && !err && !text) err = "ERR no report yet\n\n";
+
+  if (err) {
+    outbuf_puts(&client->out, err);
+  } else {
+    outbuf_puts(&client->out, text);
+    outbuf_putc(&client->out, '\n');
+  }
+  pthread_rwlock_unlock(&entrylock);
+}
+
+
+/* send as much of the answers as the socket takes, returns 1 when the
+ * client should be dropped */
+static int flush_client(client_t *client) {
+  ssize_t n;
+
+  while (client->sent < client->out.len) {
+    n = send(client->fd, client->out.buf + client->sent,
+	     client->out.len - client->sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n <= 0) return 1;
+    client->sent += n;
+  }
+  client->out.len = client->sent = 0;
+  client->out.buf[0] = 0;
+  return client->eof;
+}
+
+
+/* read queries from a client, returns 1 when it should be dropped */
+static int serve_client(client_t *client) {
+  ssize_t n;
+  char *eol;
+
+  n = recv(client->fd, client->query + client->len,
+	   sizeof(client->query) - 1 - client->len, 0);
+  if (n < 0) return errno != EINTR && errno != EAGAIN;
+  /* a client done asking still gets its answers */
+  if (n == 0) {
+    client->eof = 1;
+    return 0;
+  }
+  client->len += n;
+  client->query[client->len] = 0;
+
+  while ((eol = strchr(client->query, '\n')) != NULL) {
+    *eol = 0;
+    answer_query(client, client->query);
+    client->len -= eol + 1 - client->query;
+    memmove(client->query, eol + 1, client->len + 1);
+  }
+
+  /* overlong query */
+  return client->len == sizeof(client->query) - 1;
+}
+
+
+static void drop_client(client_t *client) {
+  close(client->fd);
+  outbuf_free(&client->out);
+}
+
+
+/* set up the listening socket */
+static int open_socket(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0x0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path %s too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(fd, DAEMON_MAXCLIENTS)) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/* PUBLIC--
+ * Keep the stations fresh in memory and answer queries on a socket.
+ */
+int run_daemon(const daemon_opts_t *opts, char **stations, int count) {
+  struct pollfd fds[DAEMON_MAXCLIENTS + 1];
+  client_t clients[DAEMON_MAXCLIENTS];
+  int nclients = 0, listenfd, fd, i;
+  pthread_t refresher;
+  short revents;
+
+  if ((listenfd = open_socket(opts->socket)) < 0) return 1;
+
+  nentries = count;
+  entries = calloc(count, sizeof(entry_t));
+  for (i = 0; i < count; i++)
+    strncpy(entries[i].station, stations[i], sizeof(entries[i].station) - 1);
+  qsort(entries, nentries, sizeof(entry_t), compare_entries);
+
+  signal(SIGINT, handle_stop);
+  signal(SIGTERM, handle_stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_create(&refresher, NULL, refresh_reports, (void *)opts);
+
+  while (!stop) {
+    fds[0].fd = listenfd;
+    fds[0].events = POLLIN;
+    /* a client with answers pending is not read from until they are
+       sent, so that one which doesn't read can't make them pile up */
+    for (i = 0; i < nclients; i++) {
+      fds[i+1].fd = clients[i].fd;
+      fds[i+1].events = clients[i].out.len ? POLLOUT : POLLIN;
+    }
+    if (poll(fds, nclients + 1, 1000) <= 0) continue;
+
+    /* serve the clients, dropping the ones which are gone or done */
+    for (i = nclients - 1; i >= 0; i--) {
+      if ((revents = fds[i+1].revents) == 0) continue;
+      /* a hangup with nothing left to read ends the queries */
+      if ((revents & (POLLHUP | POLLERR)) && !(revents & POLLIN))
+	clients[i].eof = 1;
+      if (((revents & POLLIN) && serve_client(&clients[i])) ||
+	  flush_client(&clients[i])) {
+	drop_client(&clients[i]);
+	clients[i] = clients[--nclients];
+      }
+    }
+
+    if ((fds[0].revents & POLLIN) &&
+	(fd = accept(listenfd, NULL, NULL)) >= 0) {
+      if (nclients == DAEMON_MAXCLIENTS) {
+	close(fd);
+      } else {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	memset(&clients[nclients], 0x0, sizeof(client_t));
+	outbuf_init(&clients[nclients].out, NULL);
+	clients[nclients++].fd = fd;
+      }
+    }
+  }
+
+  for (i = 0; i < nclients; i++)
+    drop_client(&clients[i]);
+  close(listenfd);
+  unlink(opts->socket);
+
+  pthread_join(refresher, NULL);
+  return 0;
+} // run_daemon
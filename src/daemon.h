@@ -0,0 +1,52 @@
+/*
+  daemon.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* default path of the socket queries are answered on */
+#define DAEMON_SOCKET "/tmp/metar.sock"
+
+/* default seconds between refreshes of the stations, or of a station
+ * whose report times aren't learnt yet when polling adaptively */
+#define DAEMON_INTERVAL 300
+
+/* max number of clients connected at the same time */
+#define DAEMON_MAXCLIENTS 64
+
+/* daemon options */
+typedef struct {
+  const char *socket;	// path of the Unix domain socket
+  int   interval;	// seconds between refreshes
+  int   adaptive;	// poll each station when its report is due
+  int   extra;		// brief reports with extra information
+  const fetch_opts_t *fetch;
+  const metar_ctx_t  *ctx;
+} daemon_opts_t;
+
+/* Keep the reports of the stations fresh in memory, refreshing them every
+ * opts->interval seconds in a background thread, or each station shortly
+ * after its next report is expected when opts->adaptive is set (see
+ * schedule.h), and answer queries on a
+ * Unix domain socket until SIGINT or SIGTERM. A query is a line
+ *   STATION [raw|brief|full|json]
+ * answered from memory with the report in that format (brief by default)
+ * followed by an empty line, or "ERR ..." and an empty line. Returns 1 if
+ * the socket can't be set up.
+ */
+int run_daemon(const daemon_opts_t *opts, char **stations, int count);
@@ -0,0 +1,1040 @@
+/*
+  fetch.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <ctype.h>
+#include <curl/curl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "metar.h"
+#include "fetch.h"
+#include "output.h"
+#include "bulk.h"
+#include "station.h"
+#include "stats.h"
+
+/* the fetch_Metars() call a fetch belongs to */
+typedef struct {
+  const fetch_opts_t *opts;
+  void *arg;
+  int cycles;	// of cycle files: failures are expected, only reported
+		// when verbose, and the times are not station fetch times
+} fetch_run_t;
+
+
+/* the fetch is of a cycle file, not of a station */
+static int cycle_file(const fetch_t *fetch) {
+  return ((const fetch_run_t *)fetch->run)->cycles;
+}
+
+
+/* failures of the fetch go unreported */
+static int quiet(const fetch_t *fetch) {
+  const fetch_run_t *run = fetch->run;
+
+  return run->cycles && !run->opts->verbose;
+}
+
+
+/* forget the data of the fetch, keeping the buffer */
+static void reset_data(fetch_t *fetch) {
+  fetch->size = 0;
+  fetch->parsed = 0;
+  fetch->nrecords = 0;
+  memset(&fetch->rec, 0x0, sizeof(noaa_rec_t));
+  if (fetch->data) fetch->data[0] = 0;
+}
+
+
+/* append received data to the fetch, returns 1 if it doesn't fit in
+ * memory */
+static int append_data(fetch_t *fetch, const char *data, size_t len) {
+  size_t alloc = fetch->alloc ? fetch->alloc : FETCH_BLOCKSIZE;
+  size_t date, report;
+  char *tmp;
+
+  if (fetch->size + len >= fetch->alloc) {
+    while (alloc <= fetch->size + len) alloc *= 2;
+
+    /* the last record points into the data */
+    date = fetch->rec.date ? fetch->rec.date - fetch->data : 0;
+    report = fetch->rec.report ? fetch->rec.report - fetch->data : 0;
+    if ((tmp = realloc(fetch->data, alloc)) == NULL) return 1;
+    if (fetch->rec.date) fetch->rec.date = tmp + date;
+    if (fetch->rec.report) fetch->rec.report = tmp + report;
+    fetch->data = tmp;
+    fetch->alloc = alloc;
+  }
+
+  memcpy(fetch->data + fetch->size, data, len);
+  fetch->size += len;
+  fetch->data[fetch->size] = 0;
+  return 0;
+}
+
+
+/* hand over the records completed since the last call; unless eof is set,
+ * a line is only complete once its newline has arrived, so a record split
+ * between two chunks waits for the second one */
+static void split_data(fetch_t *fetch, int eof) {
+  const fetch_run_t *run = fetch->run;
+  const char *p, *end, *next;
+  noaa_rec_t rec;
+
+  uint64_t start;
+
+  if (fetch->data == NULL) return;
+  p = fetch->data + fetch->parsed;
+  end = fetch->data + fetch->size;
+  start = stats_start();
+  while ((next = next_NOAA_record(p, end, eof, &rec)) != NULL) {
+    stats_stop(STAT_SPLIT, start);
+    fetch->rec = rec;
+    fetch->nrecords++;
+    if (run->opts->record) run->opts->record(fetch, &rec, run->arg);
+    p = next;
+    start = stats_start();
+  }
+  fetch->parsed = p - fetch->data;
+}
+
+
+/* report a completed fetch and free its data */
+static void deliver(fetch_t *fetch, fetch_cb done) {
+  const fetch_run_t *run = fetch->run;
+
+  if (done) done(fetch, run->arg);
+  free(fetch->data);
+  fetch->data = NULL;
+  fetch->alloc = 0;
+  reset_data(fetch);
+}
+
+
+/* a transfer of a station file from one of the mirrors; a fetch has one
+ * transfer, or two while it is hedged */
+typedef struct {
+  CURL    *handle;
+  fetch_t *fetch;	// NULL when idle
+  int      mirror;	// index of the base URL
+  struct curl_slist *headers;
+} transfer_t;
+
+
+/* fetch times of the stations, for the hedge delay; shared by the
+ * fetch_Metars() calls of all threads */
+static histogram_t latency;
+static pthread_mutex_t latencylock = PTHREAD_MUTEX_INITIALIZER;
+
+/* libcurl is set up once, curl_global_init() isn't thread safe */
+static pthread_once_t curlonce = PTHREAD_ONCE_INIT;
+
+
+static void init_curl(void) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+
+/* monotonic time in ms */
+static long long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* the response of the first transfer to claim the fetch is the one used,
+ * the other transfer of the fetch is dropped */
+static void claim(transfer_t *transfer) {
+  fetch_t *fetch = transfer->fetch;
+
+  if (fetch->handle) return;
+  fetch->handle = transfer->handle;
+  reset_data(fetch);
+}
+
+
+/* take in a chunk of the response and decode the records it completes */
+static size_t receiveData(void *buffer, size_t size, size_t nmemb,
+			  void *stream) {
+  transfer_t *transfer = stream;
+  fetch_t *fetch = transfer->fetch;
+  long code = 0;
+
+  size *= nmemb;
+
+  /* other protocols than HTTP have no status line to claim the fetch */
+  curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &code);
+  if (code == 0) claim(transfer);
+  if (fetch->handle != transfer->handle) return size;
+
+  if (append_data(fetch, buffer, size)) return 0;
+
+  /* an error page is no NOAA data */
+  if (code == 200 || code == 0) split_data(fetch, 0);
+  return size;
+}
+
+
+/* claim the fetch with the status line of a response, and pick the
+ * validators out of the headers of the response claiming it */
+static size_t receiveHeader(char *buffer, size_t size, size_t nmemb,
+			    void *stream) {
+  transfer_t *transfer = stream;
+  fetch_t *fetch = transfer->fetch;
+  size_t len = size * nmemb, n;
+  char *value, *dst;
+  long code;
+
+  /* a server error leaves the fetch to the other mirror */
+  if (len > 12 && strncmp(buffer, "HTTP/", 5) == 0 &&
+      (value = memchr(buffer, ' ', len)) != NULL) {
+    code = strtol(value, NULL, 10);
+    if (code >= 200 && code < 500) claim(transfer);
+    /* the validators of the cache are only those of this response */
+    if (fetch->handle == transfer->handle)
+      fetch->lastmod[0] = fetch->etag[0] = 0;
+    return len;
+  }
+  if (fetch->handle != transfer->handle) return len;
+
+  if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+    value = buffer + 14;
+    dst = fetch->lastmod;
+    n = sizeof(fetch->lastmod);
+  } else if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+    value = buffer + 5;
+    dst = fetch->etag;
+    n = sizeof(fetch->etag);
+  } else return len;
+
+  len -= value - buffer;
+  while (len && isspace((unsigned char)*value)) { value++; len--; }
+  while (len && isspace((unsigned char)value[len-1])) len--;
+  if (len < n) {
+    memcpy(dst, value, len);
+    dst[len] = 0;
+  }
+  return size * nmemb;
+}
+
+
+/* path of a file of the station in the cache */
+static void cache_path(const fetch_opts_t *opts, const fetch_t *fetch,
+		       const char *ext, char *path) {
+  snprintf(path, URL_MAXSIZE, "%s/%s.%s", opts->cachedir, fetch->station, ext);
+}
+
+
+/* read the cached report of the station into the fetch, returns 0 if it is
+ * in the cache; age is set to its age in seconds */
+static int cache_load(const fetch_opts_t *opts, fetch_t *fetch, time_t *age) {
+  char path[URL_MAXSIZE], buf[BUFSIZ];
+  struct stat st;
+  size_t n;
+  FILE *fp;
+
+  cache_path(opts, fetch, "TXT", path);
+  if (stat(path, &st) || (fp = fopen(path, "r")) == NULL) return 1;
+  *age = time(NULL) - st.st_mtime;
+
+  reset_data(fetch);
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    if (append_data(fetch, buf, n)) break;
+  fclose(fp);
+
+  /* validators for revalidating the report */
+  cache_path(opts, fetch, "hdr", path);
+  if ((fp = fopen(path, "r")) != NULL) {
+    if (fgets(fetch->lastmod, sizeof(fetch->lastmod), fp))
+      fetch->lastmod[strcspn(fetch->lastmod, "\n")] = 0;
+    if (fgets(fetch->etag, sizeof(fetch->etag), fp))
+      fetch->etag[strcspn(fetch->etag, "\n")] = 0;
+    fclose(fp);
+  }
+  return 0;
+}
+
+
+/* store the fetched report and its validators in the cache */
+static void cache_store(const fetch_opts_t *opts, const fetch_t *fetch) {
+  char path[URL_MAXSIZE], tmp[URL_MAXSIZE + 4];
+  FILE *fp;
+
+  cache_path(opts, fetch, "hdr", path);
+  if ((fp = fopen(path, "w")) != NULL) {
+    fprintf(fp, "%s\n%s\n", fetch->lastmod, fetch->etag);
+    fclose(fp);
+  }
+
+  /* replace the report atomically, readers never see half of it */
+  cache_path(opts, fetch, "TXT", path);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((fp = fopen(tmp, "w")) == NULL) return;
+  if (fwrite(fetch->data, 1, fetch->size, fp) != fetch->size) {
+    fclose(fp);
+    remove(tmp);
+    return;
+  }
+  fclose(fp);
+  rename(tmp, path);
+}
+
+
+/* the cached report is still valid, restart its time to live */
+static void cache_touch(const fetch_opts_t *opts, const fetch_t *fetch) {
+  char path[URL_MAXSIZE];
+
+  cache_path(opts, fetch, "TXT", path);
+  utime(path, NULL);
+}
+
+
+/* start a transfer of the station file of the fetch from a mirror */
+static int start_transfer(CURLM *multi, transfer_t *transfer, fetch_t *fetch,
+			  const fetch_opts_t *opts, const char **urls,
+			  int mirror) {
+  struct curl_slist *headers = NULL;
+  CURL *curlhandle = transfer->handle;
+  char url[URL_MAXSIZE];
+  char header[URL_MAXSIZE];
+
+  if (snprintf(url, URL_MAXSIZE, "%s/%s.TXT", urls[mirror],
+	       fetch->station) < 0)
+    return 1;
+  if (opts->verbose) printf("Retrieving URL %s\n", url);
+
+  /* revalidate a cached report instead of transferring it again */
+  if (fetch->cached) {
+    if (fetch->etag[0]) {
+      snprintf(header, sizeof(header), "If-None-Match: %s", fetch->etag);
+      headers = curl_slist_append(headers, header);
+    }
+    if (fetch->lastmod[0]) {
+      snprintf(header, sizeof(header), "If-Modified-Since: %s",
+	       fetch->lastmod);
+      headers = curl_slist_append(headers, header);
+    }
+  }
+
+  curl_easy_setopt(curlhandle, CURLOPT_URL, url);
+  curl_easy_setopt(curlhandle, CURLOPT_WRITEFUNCTION, receiveData);
+  curl_easy_setopt(curlhandle, CURLOPT_WRITEDATA, transfer);
+  curl_easy_setopt(curlhandle, CURLOPT_HEADERFUNCTION, receiveHeader);
+  curl_easy_setopt(curlhandle, CURLOPT_HEADERDATA, transfer);
+  curl_easy_setopt(curlhandle, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curlhandle, CURLOPT_PRIVATE, transfer);
+  curl_easy_setopt(curlhandle, CURLOPT_CONNECTTIMEOUT_MS,
+		   opts->connecttimeout);
+  curl_easy_setopt(curlhandle, CURLOPT_TIMEOUT_MS, opts->timeout);
+
+  if (curl_multi_add_handle(multi, curlhandle) != CURLM_OK) {
+    curl_slist_free_all(headers);
+    return 1;
+  }
+  transfer->fetch = fetch;
+  transfer->mirror = mirror;
+  transfer->headers = headers;
+  fetch->ntransfers++;
+  return 0;
+}
+
+
+/* take a transfer off its fetch, the handle is idle again */
+static void end_transfer(CURLM *multi, transfer_t *transfer) {
+  curl_multi_remove_handle(multi, transfer->handle);
+  curl_slist_free_all(transfer->headers);
+  transfer->headers = NULL;
+  transfer->fetch->ntransfers--;
+  transfer->fetch = NULL;
+}
+
+
+/* an idle transfer of the pool, or NULL */
+static transfer_t *idle_transfer(transfer_t *pool, int npool) {
+  int i;
+
+  for (i = 0; i < npool; i++)
+    if (pool[i].fetch == NULL) return &pool[i];
+  return NULL;
+}
+
+
+/* ms a station waits for its first mirror before a second one is asked
+ * too, 0 for never and with a single mirror; automatically the p95 of the
+ * fetch times seen */
+static long hedge_delay(const fetch_opts_t *opts, int nurls) {
+  long delay;
+
+  if (nurls < 2) return 0;
+  if (opts->hedge != FETCH_HEDGE_AUTO) return opts->hedge;
+  pthread_mutex_lock(&latencylock);
+  if (latency.count < FETCH_HEDGE_SAMPLES)
+    delay = FETCH_HEDGE_DELAY;
+  else
+    delay = histogram_quantile(&latency, 0.95) / 1000000;
+  pthread_mutex_unlock(&latencylock);
+  return delay < FETCH_HEDGE_MIN ? FETCH_HEDGE_MIN : delay;
+}
+
+
+/* add the phases of a transfer to the statistics; the times of curl are
+ * in microseconds since the start of the transfer, and a reused
+ * connection has no lookup, connect or handshake */
+static void transfer_stats(CURL *curlhandle, const fetch_t *fetch) {
+  curl_off_t dns = 0, connect = 0, tls = 0, first = 0, total = 0, size = 0;
+  long nconnects = 0;
+
+  curl_easy_getinfo(curlhandle, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(curlhandle, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(curlhandle, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(curlhandle, CURLINFO_STARTTRANSFER_TIME_T, &first);
+  curl_easy_getinfo(curlhandle, CURLINFO_TOTAL_TIME_T, &total);
+  curl_easy_getinfo(curlhandle, CURLINFO_NUM_CONNECTS, &nconnects);
+  curl_easy_getinfo(curlhandle, CURLINFO_SIZE_DOWNLOAD_T, &size);
+
+  if (nconnects) {
+    stats_add(STAT_DNS, dns * 1000);
+    stats_add(STAT_CONNECT, (connect - dns) * 1000);
+    if (tls) stats_add(STAT_TLS, (tls - connect) * 1000);
+  }
+  if (tls > connect) connect = tls;
+  if (first >= connect) stats_add(STAT_WAIT, (first - connect) * 1000);
+  if (total >= first) stats_add(STAT_TRANSFER, (total - first) * 1000);
+  stats_count(STAT_BYTES, size);
+}
+
+
+/* the transfer claiming the fetch is over, settle the result */
+static void finish_fetch(const fetch_opts_t *opts, transfer_t *transfer) {
+  CURL *curlhandle = transfer->handle;
+  fetch_t *fetch = transfer->fetch;
+  uint64_t elapsed;
+  long code = 0;
+  time_t age;
+
+  /* the time of the station from its first transfer on, which is what
+     hedging cuts down; the far larger cycle files would skew it */
+  elapsed = (now_ms() - fetch->started) * 1000000;
+  if (!cycle_file(fetch)) {
+    pthread_mutex_lock(&latencylock);
+    histogram_add(&latency, elapsed);
+    pthread_mutex_unlock(&latencylock);
+  }
+  fetch->status = 0;
+  if (stats_enabled) {
+    transfer_stats(curlhandle, fetch);
+    if (!cycle_file(fetch)) stats_station(fetch->station, elapsed);
+  }
+
+  /* a cycle file not published yet is no failure */
+  curl_easy_getinfo(curlhandle, CURLINFO_RESPONSE_CODE, &code);
+  if (code != 200 && code != 304 && code != 0 && !cycle_file(fetch))
+    stats_count(STAT_FAILURES, 1);
+  if (code == 304 && fetch->cached && cache_load(opts, fetch, &age) == 0) {
+    /* not modified, the cached report is good for another while */
+    if (opts->verbose) printf("Report of %s not modified\n", fetch->station);
+    cache_touch(opts, fetch);
+    split_data(fetch, 1);
+  } else if (code == 200 || code == 0) {
+    /* the last line may lack its newline */
+    fetch->cached = 0;
+    split_data(fetch, 1);
+    if (code == 200 && opts->cachedir) cache_store(opts, fetch);
+  } else {
+    fetch->cached = 0;
+  }
+}
+
+
+/* a transfer is over; returns 1 when its fetch is settled, 0 while the
+ * other transfer or one to the next mirror is still to come */
+static int transfer_done(CURLM *multi, transfer_t *pool, int npool,
+			 transfer_t *transfer, CURLcode res,
+			 const fetch_opts_t *opts, const char **urls,
+			 int nurls) {
+  fetch_t *fetch = transfer->fetch;
+  int mirror = transfer->mirror, i;
+  long code = 0;
+
+  /* the response of the other mirror is used */
+  if (fetch->handle && fetch->handle != transfer->handle) {
+    end_transfer(multi, transfer);
+    return 0;
+  }
+
+  curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &code);
+  if (fetch->handle == transfer->handle) {
+    if (res == CURLE_OK) {
+      finish_fetch(opts, transfer);
+      end_transfer(multi, transfer);
+      return 1;
+    }
+    /* broken off; the other transfer has thrown its response away */
+    fetch->handle = NULL;
+    for (i = 0; i < npool; i++)
+      if (pool[i].fetch == fetch) end_transfer(multi, &pool[i]);
+  } else {
+    /* failed or a server error, the other transfer may still make it */
+    end_transfer(multi, transfer);
+    if (fetch->ntransfers) return 0;
+  }
+
+  /* ask the next mirror unless it has been asked already, or there is
+     none but the one which failed */
+  if (!fetch->hedged && nurls > 1) {
+    fetch->hedged = 1;
+    mirror = (mirror + 1) % nurls;
+    if (opts->verbose)
+      printf("Retrying %s from %s\n", fetch->station, urls[mirror]);
+    if (start_transfer(multi, transfer, fetch, opts, urls, mirror) == 0)
+      return 0;
+  }
+
+  if (!quiet(fetch)) {
+    if (res != CURLE_OK)
+      fprintf(stderr, "CURL error %i while retrieving URL\n", res);
+    else
+      fprintf(stderr, "HTTP error %ld while retrieving URL\n", code);
+  }
+  fetch->status = 1;
+  if (!cycle_file(fetch)) stats_count(STAT_FAILURES, 1);
+  return 1;
+}
+
+
+/* PUBLIC--
+ * Set the default fetch options.
+ */
+void fetch_opts_init(fetch_opts_t *opts) {
+  memset(opts, 0x0, sizeof(fetch_opts_t));
+  opts->maxconn = FETCH_MAXCONN;
+  opts->cachettl = FETCH_CACHETTL;
+  opts->connecttimeout = FETCH_CONNECTTIMEOUT;
+  opts->timeout = FETCH_TIMEOUT;
+  opts->hedge = FETCH_HEDGE_AUTO;
+  opts->cycles = FETCH_CYCLES;
+} // fetch_opts_init
+
+
+/* fetch the station files with libcurl from the mirrors, keeping at most
+ * opts->maxconn stations in flight, and report them in array order */
+static int fetch_curl(fetch_t *fetches, int count, const fetch_opts_t *opts,
+		      const char **urls, int nurls, fetch_cb done,
+		      void *arg) {
+  CURLM *multi;
+  CURLMsg *msg;
+  transfer_t *pool, *transfer;
+  fetch_t *fetch;
+  int maxconn = opts->maxconn, npool;
+  int next = 0, reported = 0, inflight = 0, running, left, i;
+  long delay, wait, due;
+  long long now;
+  time_t age;
+
+  /* serve fresh reports from the cache without touching the network */
+  if (opts->cachedir) {
+    if (mkdir(opts->cachedir, 0755) && errno != EEXIST)
+      perror(opts->cachedir);
+    for (i = 0; i < count; i++) {
+      fetch = &fetches[i];
+      if (fetch->done || cache_load(opts, fetch, &age)) continue;
+      fetch->cached = 1;
+      if (age < opts->cachettl) {
+	if (opts->verbose) printf("Using cached report of %s\n", fetch->station);
+	split_data(fetch, 1);
+	fetch->done = 1;
+      }
+    }
+  }
+
+  if (maxconn < 1) maxconn = 1;
+  if (maxconn > count) maxconn = count;
+
+  /* a station in flight may have a second transfer while hedged */
+  pthread_once(&curlonce, init_curl);
+  multi = curl_multi_init();
+  if (!multi) return 1;
+  curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)(2 * maxconn));
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+  /* pool of handles, reused for the following stations once idle */
+  pool = calloc(2 * maxconn, sizeof(transfer_t));
+  for (npool = 0; npool < 2 * maxconn; npool++)
+    if ((pool[npool].handle = curl_easy_init()) == NULL) break;
+  if (npool == 0) {
+    free(pool);
+    curl_multi_cleanup(multi);
+    return 1;
+  }
+
+  while (reported < count) {
+    now = now_ms();
+    delay = hedge_delay(opts, nurls);
+
+    /* hedge the stations the first mirror hasn't answered in time */
+    for (i = 0; delay > 0 && i < npool; i++) {
+      fetch = pool[i].fetch;
+      if (fetch == NULL || fetch->handle || fetch->hedged ||
+	  now - fetch->started < delay) continue;
+      if ((transfer = idle_transfer(pool, npool)) == NULL) break;
+      fetch->hedged = 1;
+      if (opts->verbose)
+	printf("Hedging %s after %lld ms\n", fetch->station,
+	       now - fetch->started);
+      start_transfer(multi, transfer, fetch, opts, urls,
+		     (pool[i].mirror + 1) % nurls);
+    }
+
+    /* keep the pool busy */
+    while (inflight < maxconn && next < count &&
+	   (transfer = idle_transfer(pool, npool)) != NULL) {
+      fetch = &fetches[next++];
+      if (fetch->done) continue;
+      fetch->started = now;
+      fetch->hedged = 0;
+      fetch->handle = NULL;
+      reset_data(fetch);
+      /* the stations take turns over the mirrors */
+      if (start_transfer(multi, transfer, fetch, opts, urls,
+			 (next - 1) % nurls)) {
+	fetch->status = 1;
+	fetch->done = 1;
+      } else {
+	inflight++;
+      }
+    }
+
+    if (inflight) {
+      curl_multi_perform(multi, &running);
+
+      while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+	if (msg->msg != CURLMSG_DONE) continue;
+	curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+			  (char **)&transfer);
+	fetch = transfer->fetch;
+	if (transfer_done(multi, pool, npool, transfer, msg->data.result,
+			  opts, urls, nurls)) {
+	  fetch->done = 1;
+	  inflight--;
+	}
+      }
+
+      /* drop the transfers whose fetch took the other mirror's response */
+      for (i = 0; i < npool; i++) {
+	fetch = pool[i].fetch;
+	if (fetch && fetch->handle && fetch->handle != pool[i].handle)
+	  end_transfer(multi, &pool[i]);
+      }
+    }
+
+    /* report completed fetches in the order they were given */
+    while (reported < count && fetches[reported].done)
+      deliver(&fetches[reported++], done);
+
+    /* wait unless another station can be started, at most until the
+       next hedge is due */
+    if (inflight && reported < count &&
+	(inflight == maxconn || next == count ||
+	 idle_transfer(pool, npool) == NULL)) {
+      wait = 1000;
+      now = now_ms();
+      for (i = 0; delay > 0 && i < npool; i++) {
+	fetch = pool[i].fetch;
+	if (fetch == NULL || fetch->handle || fetch->hedged) continue;
+	due = fetch->started + delay - now;
+	if (due < wait) wait = due < 0 ? 0 : due;
+      }
+      curl_multi_wait(multi, NULL, 0, wait, NULL);
+    }
+  }
+
+  for (i = 0; i < npool; i++) {
+    if (pool[i].fetch) end_transfer(multi, &pool[i]);
+    curl_easy_cleanup(pool[i].handle);
+  }
+  free(pool);
+  curl_multi_cleanup(multi);
+  return 0;
+}
+
+
+/* read the station files from a local directory mirror, named like the
+ * files on the server; the cache would only copy them */
+static int fetch_file(fetch_t *fetches, int count, const fetch_opts_t *opts,
+		      const char **urls, int nurls, fetch_cb done,
+		      void *arg) {
+  const char *dir = urls[0] + 7;
+  char path[URL_MAXSIZE], buf[BUFSIZ];
+  fetch_t *fetch;
+  uint64_t start;
+  size_t n;
+  FILE *fp;
+  int i;
+
+  /* file://host/path, only the local host is reachable */
+  if (*dir != '/') dir += strcspn(dir, "/");
+
+  for (i = 0; i < count; i++) {
+    fetch = &fetches[i];
+    if (fetch->done) {
+      deliver(fetch, done);
+      continue;
+    }
+    snprintf(path, URL_MAXSIZE, "%s/%s.TXT", dir, fetch->station);
+    if (opts->verbose) printf("Reading file %s\n", path);
+
+    reset_data(fetch);
+    start = stats_start();
+    if ((fp = fopen(path, "r")) == NULL) {
+      if (!quiet(fetch)) perror(path);
+      fetch->status = 1;
+    } else {
+      fetch->status = 0;
+      while (!fetch->status && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+	fetch->status = append_data(fetch, buf, n);
+	split_data(fetch, 0);
+      }
+      if (ferror(fp)) fetch->status = 1;
+      if (fetch->status && !quiet(fetch)) perror(path);
+      else split_data(fetch, 1);
+      fclose(fp);
+    }
+    if (stats_enabled && !cycle_file(fetch)) {
+      stats_station(fetch->station, stats_start() - start);
+      stats_count(fetch->status ? STAT_FAILURES : STAT_BYTES,
+		  fetch->status ? 1 : fetch->size);
+    } else if (stats_enabled && !fetch->status) {
+      stats_count(STAT_BYTES, fetch->size);
+    }
+    fetch->done = 1;
+    deliver(fetch, done);
+  }
+  return 0;
+}
+
+
+/* stations wanted from the NOAA data on standard input */
+typedef struct {
+  fetch_t *fetches;
+  int count;
+} stdin_state_t;
+
+
+/* keep the record for each station it is the report of, the last one of a
+ * station wins like in the station files which are appended to */
+static void stdin_record(const noaa_rec_t *rec, void *arg) {
+  stdin_state_t *state = arg;
+  fetch_t *fetch;
+  size_t len;
+  int i;
+
+  for (i = 0; i < state->count; i++) {
+    fetch = &state->fetches[i];
+    len = strlen(fetch->station);
+    if (rec->reportlen <= len || rec->report[len] != ' ' ||
+	memcmp(rec->report, fetch->station, len)) continue;
+
+    /* in the format of a station file, decoded right away */
+    reset_data(fetch);
+    if ((rec->datelen && (append_data(fetch, rec->date, rec->datelen) ||
+			  append_data(fetch, "\n", 1))) ||
+	append_data(fetch, rec->report, rec->reportlen) ||
+	append_data(fetch, "\n", 1)) {
+      reset_data(fetch);
+      continue;
+    }
+    split_data(fetch, 1);
+  }
+}
+
+
+/* pick the stations out of NOAA data on standard input, in the format of
+ * the station files or concatenated ones like metar -f reads */
+static int fetch_stdin(fetch_t *fetches, int count, const fetch_opts_t *opts,
+		       const char **urls, int nurls, fetch_cb done,
+		       void *arg) {
+  stdin_state_t state = { fetches, count };
+  int i, status;
+
+  for (i = 0; i < count; i++) reset_data(&fetches[i]);
+  if (opts->verbose) printf("Reading NOAA data from standard input\n");
+  status = bulk_Metars("-", stdin_record, &state);
+
+  /* stations not on the input are reported as not found in the data */
+  for (i = 0; i < count; i++) {
+    fetches[i].status = status;
+    fetches[i].done = 1;
+    deliver(&fetches[i], done);
+  }
+  return 0;
+}
+
+
+/* transports by the start of the base URL, anything else goes to libcurl */
+static const struct {
+  const char *prefix;
+  fetch_transport_fn fetch;
+} transports[] = {
+  { "file://", fetch_file },
+  { "-", fetch_stdin },
+};
+
+
+/* PUBLIC--
+ * Pick the transport for the base URL.
+ */
+fetch_transport_fn fetch_transport(const char *url) {
+  size_t i, len;
+
+  for (i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+    len = strlen(transports[i].prefix);
+    if (strncasecmp(url, transports[i].prefix, len) == 0 &&
+	(len > 1 || url[1] == 0))
+      return transports[i].fetch;
+  }
+  return fetch_curl;
+} // fetch_transport
+
+
+/* the latest report of a station in the cycle files */
+typedef struct {
+  uint32_t   key;	// STATION_KEY() of the station, 0 for a free slot
+  noaa_rec_t rec;
+} cycle_entry_t;
+
+/* the cycle files, oldest first, and their reports by station */
+typedef struct {
+  fetch_t        files[FETCH_NCYCLES];
+  char          *data[FETCH_NCYCLES];	// taken over from the fetches
+  size_t         size[FETCH_NCYCLES];
+  cycle_entry_t *table;		// open addressed, a power of two in size
+  size_t         tablesize, nstations;
+  char           oldest[20];	// date line of the oldest report used
+} cycles_t;
+
+
+/* the base URL of the cycle files of a mirror: the cycles directory
+ * beside the stations directory, as on the NOAA server, or under the
+ * mirror */
+static void cycle_url(const char *url, char *cycles) {
+  size_t len = strlen(url);
+
+  while (len && url[len - 1] == '/') len--;
+  if (len >= 9 && strncmp(url + len - 9, "/stations", 9) == 0) len -= 9;
+  snprintf(cycles, URL_MAXSIZE, "%.*s/cycles", (int)len, url);
+}
+
+
+/* keep the data of a fetched cycle file for the index */
+static void cycle_done(fetch_t *fetch, void *arg) {
+  cycles_t *cycles = arg;
+  int i = fetch - cycles->files;
+
+  /* an error page has no records */
+  if (fetch->status || fetch->nrecords == 0) return;
+  cycles->data[i] = fetch->data;
+  cycles->size[i] = fetch->size;
+  fetch->data = NULL;
+  fetch->alloc = 0;
+}
+
+
+/* the slot of the station in the table, free if it isn't there */
+static cycle_entry_t *cycle_slot(cycle_entry_t *table, size_t size,
+				 uint32_t key) {
+  size_t i = station_hash(key, 0) & (size - 1);
+
+  while (table[i].key && table[i].key != key) i = (i + 1) & (size - 1);
+  return &table[i];
+}
+
+
+/* index a report of a cycle file by its station, unless a later one of
+ * the station is there already; the reports of cycle files have their
+ * dates, and reports from before the cycles asked for are left out */
+static void cycle_record(cycles_t *cycles, const noaa_rec_t *rec) {
+  cycle_entry_t *table, *entry;
+  char icao[5];
+  size_t size, i;
+
+  if (rec->datelen != 16 || memcmp(rec->date, cycles->oldest, 16) < 0 ||
+      rec->reportlen < 5 || rec->report[4] != ' ') return;
+  memcpy(icao, rec->report, 4);
+  icao[4] = 0;
+  if (!station_valid(icao)) return;
+
+  /* keep the table at most half full */
+  if (2 * (cycles->nstations + 1) > cycles->tablesize) {
+    size = cycles->tablesize ? cycles->tablesize * 2 : 1024;
+    if ((table = calloc(size, sizeof(cycle_entry_t))) == NULL) return;
+    for (i = 0; i < cycles->tablesize; i++)
+      if (cycles->table[i].key)
+	*cycle_slot(table, size, cycles->table[i].key) = cycles->table[i];
+    free(cycles->table);
+    cycles->table = table;
+    cycles->tablesize = size;
+  }
+
+  entry = cycle_slot(cycles->table, cycles->tablesize, STATION_KEY(icao));
+  if (entry->key == 0) {
+    entry->key = STATION_KEY(icao);
+    cycles->nstations++;
+  } else if (memcmp(rec->date, entry->rec.date, 16) < 0) {
+    return;
+  }
+  entry->rec = *rec;
+}
+
+
+/* Answer the stations from the cycle files of the last FETCH_NCYCLES
+ * hours, fetched with the transport from the cycles directories of the
+ * mirrors. The stations found are done, in the format of their station
+ * files; the others are left to be fetched. Returns the number found. */
+static int fetch_cycles(fetch_t *fetches, int count, const fetch_opts_t *opts,
+			fetch_transport_fn transport, const char **urls,
+			int nurls) {
+  char cycleurls[FETCH_MAXMIRRORS][URL_MAXSIZE];
+  const char *curls[FETCH_MAXMIRRORS];
+  const cycle_entry_t *entry;
+  const noaa_rec_t *rec;
+  const char *p, *end;
+  noaa_rec_t crec;
+  fetch_opts_t copts = *opts;
+  cycles_t cycles;
+  fetch_run_t run = { &copts, &cycles, 1 };
+  fetch_t *fetch;
+  time_t now = time(NULL), t;
+  struct tm tm;
+  int i, found = 0;
+
+  memset(&cycles, 0x0, sizeof(cycles));
+  copts.record = NULL;
+  /* the delay learnt from station files would hedge every cycle file */
+  copts.hedge = 0;
+  for (i = 0; i < nurls; i++) {
+    cycle_url(urls[i], cycleurls[i]);
+    curls[i] = cycleurls[i];
+  }
+  for (i = 0; i < FETCH_NCYCLES; i++) {
+    t = now - (FETCH_NCYCLES - 1 - i) * 3600;
+    gmtime_r(&t, &tm);
+    snprintf(cycles.files[i].station, sizeof(cycles.files[i].station),
+	     "%02dZ", tm.tm_hour);
+    cycles.files[i].run = &run;
+  }
+
+  /* a cycle file is overwritten a day later, until then it has the
+     reports of the day before */
+  t = now - FETCH_CYCLE_MAXAGE;
+  gmtime_r(&t, &tm);
+  strftime(cycles.oldest, sizeof(cycles.oldest), "%Y/%m/%d %H:%M", &tm);
+
+  if (opts->verbose)
+    printf("Fetching the cycle files for %d stations\n", count);
+  if (transport(cycles.files, FETCH_NCYCLES, &copts, curls, nurls,
+		cycle_done, &cycles) == 0) {
+    for (i = 0; i < FETCH_NCYCLES; i++) {
+      p = cycles.data[i];
+      end = p ? p + cycles.size[i] : NULL;
+      while (p && (p = next_NOAA_record(p, end, 1, &crec)) != NULL)
+	cycle_record(&cycles, &crec);
+    }
+  }
+
+  for (i = 0; cycles.tablesize && i < count; i++) {
+    fetch = &fetches[i];
+    if (strlen(fetch->station) != 4) continue;
+    entry = cycle_slot(cycles.table, cycles.tablesize,
+		       STATION_KEY(fetch->station));
+    if (entry->key == 0) continue;
+
+    /* in the format of a station file */
+    rec = &entry->rec;
+    reset_data(fetch);
+    if (append_data(fetch, rec->date, rec->datelen) ||
+	append_data(fetch, "\n", 1) ||
+	append_data(fetch, rec->report, rec->reportlen) ||
+	append_data(fetch, "\n", 1)) {
+      reset_data(fetch);
+      continue;
+    }
+    split_data(fetch, 1);
+    fetch->status = 0;
+    fetch->done = 1;
+    found++;
+  }
+  if (opts->verbose)
+    printf("Found %d of %d stations in the cycle files\n", found, count);
+
+  free(cycles.table);
+  for (i = 0; i < FETCH_NCYCLES; i++) free(cycles.data[i]);
+  return found;
+}
+
+
+/* PUBLIC--
+ * Fetch the NOAA data of count stations from the mirrors of opts->urls,
+ * METARURL or the NOAA server, and report them in array order.
+ */
+int fetch_Metars(fetch_t *fetches, int count, const fetch_opts_t *opts,
+		 fetch_cb done, void *arg) {
+  fetch_run_t run = { opts, arg, 0 };
+  char list[FETCH_MAXMIRRORS * URL_MAXSIZE], *p, *save;
+  const char *urls[FETCH_MAXMIRRORS];
+  fetch_transport_fn transport;
+  int nurls = 0, i;
+
+  for (i = 0; i < count; i++) fetches[i].run = &run;
+
+  if (opts->nurls) {
+    for (nurls = 0; nurls < opts->nurls; nurls++)
+      urls[nurls] = opts->urls[nurls];
+  } else if (getenv("METARURL") == NULL) {
+    urls[nurls++] = METARURL;
+  } else {
+    /* the mirrors separated by whitespace */
+    memset(list, 0x0, sizeof(list));
+    strncpy(list, getenv("METARURL"), sizeof(list) - 1);
+    if (opts->verbose)
+      printf("Using environment variable METARURL: %s\n", list);
+    for (p = strtok_r(list, " \t\n", &save); p && nurls < FETCH_MAXMIRRORS;
+	 p = strtok_r(NULL, " \t\n", &save))
+      urls[nurls++] = p;
+    if (nurls == 0) urls[nurls++] = METARURL;
+  }
+
+  /* many stations come cheaper in a few large files than one by one */
+  transport = fetch_transport(urls[0]);
+  if (opts->cycles && count >= opts->cycles &&
+      (transport == fetch_curl || transport == fetch_file))
+    fetch_cycles(fetches, count, opts, transport, urls, nurls);
+
+  return transport(fetches, count, opts, urls, nurls, done, arg);
+} // fetch_Metars
@@ -0,0 +1,145 @@
+/*
+  fetch.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* default number of transfers kept in flight at the same time */
+#define FETCH_MAXCONN 8
+
+/* default time in seconds a cached report is used without asking the
+ * server; NOAA updates the station files about twice an hour */
+#define FETCH_CACHETTL 300
+
+/* max number of mirrors of the station files */
+#define FETCH_MAXMIRRORS 8
+
+/* default deadlines of a transfer in ms, to connect and to complete */
+#define FETCH_CONNECTTIMEOUT 10000
+#define FETCH_TIMEOUT        30000
+
+/* hedging: with more than one mirror, by default a station which hasn't
+ * been answered in the p95 of the fetch times seen, and at least
+ * FETCH_HEDGE_MIN ms, is asked from the next mirror too; until
+ * FETCH_HEDGE_SAMPLES fetches have been timed the delay is
+ * FETCH_HEDGE_DELAY ms */
+#define FETCH_HEDGE_AUTO    -1
+#define FETCH_HEDGE_DELAY   1000
+#define FETCH_HEDGE_MIN     20
+#define FETCH_HEDGE_SAMPLES 20
+
+/* cycle files: for at least FETCH_CYCLES stations, the hourly files with
+ * the reports of all stations are fetched instead of the station files,
+ * the current hour's and FETCH_NCYCLES - 1 before it; reports older than
+ * FETCH_CYCLE_MAXAGE seconds in them are ignored */
+#define FETCH_CYCLES       100
+#define FETCH_NCYCLES      2
+#define FETCH_CYCLE_MAXAGE 7200
+
+/* size of the first block of the received data, doubled as needed */
+#define FETCH_BLOCKSIZE 1024
+
+/* one station to be fetched */
+typedef struct {
+  char   station[10];
+  char  *data;		// NOAA data, nul terminated, NULL when empty
+  size_t size;
+  noaa_rec_t rec;	// last record of the data
+  int    nrecords;	// records in the data
+  int    status;	// 0 when fetched, 1 on failure
+  int    done;
+  int    cached;	// 1 when the data came from the cache
+  char   lastmod[64];	// Last-Modified of the response
+  char   etag[128];	// ETag of the response
+  void  *handle;	// transfer whose response is used, internal
+  int    ntransfers;	// transfers in flight, internal
+  int    hedged;	// 1 once a second mirror has been asked, internal
+  long long started;	// ms when the first transfer started, internal
+  const void *run;	// fetch_Metars() call, internal
+  size_t alloc, parsed;	// size of data and of its records, internal
+} fetch_t;
+
+/* called once for each fetch when its NOAA data is available; the data
+ * and the record are freed when it returns */
+typedef void (*fetch_cb)(fetch_t *fetch, void *arg);
+
+/* called for each record of NOAA data as soon as it has been received,
+ * while the rest of the data may still be in flight; the record is only
+ * valid during the call */
+typedef void (*fetch_rec_cb)(fetch_t *fetch, const noaa_rec_t *rec,
+			     void *arg);
+
+/* fetch options, see fetch_opts_init() for defaults */
+typedef struct {
+  const char *urls[FETCH_MAXMIRRORS];	// base URLs of the station files
+  int   nurls;		// mirrors in urls, 0 for METARURL
+  int   maxconn;	// stations in flight
+  long  connecttimeout;	// ms to connect, 0 for no limit
+  long  timeout;	// ms to complete a transfer, 0 for no limit
+  long  hedge;		// ms before hedging, 0 for never, or FETCH_HEDGE_AUTO
+  const char *cachedir;	// report cache directory, NULL for no cache
+  int   cachettl;	// seconds a cached report is fresh
+  int   cycles;		// stations from which on cycle files are used, 0 never
+  fetch_rec_cb record;	// called for each record received, or NULL
+  int   verbose;	// print progress to stdout
+} fetch_opts_t;
+
+/* a transport, brings the NOAA data of the stations from the base URL */
+typedef int (*fetch_transport_fn)(fetch_t *fetches, int count,
+				  const fetch_opts_t *opts,
+				  const char **urls, int nurls,
+				  fetch_cb done, void *arg);
+
+/* Set the default fetch options: FETCH_MAXCONN stations in flight, the
+ * default deadlines and hedging, cycle files from FETCH_CYCLES stations
+ * on, no cache. */
+void fetch_opts_init(fetch_opts_t *opts);
+
+/* Pick the transport for a base URL: file:// reads the station files from
+ * a local directory mirror, "-" picks the stations out of NOAA data on
+ * standard input, and anything else is fetched with libcurl.
+ */
+fetch_transport_fn fetch_transport(const char *url);
+
+/* Fetch the NOAA data of count stations from the mirrors in opts->urls,
+ * those listed in the METARURL environment variable separated by
+ * whitespace, or the NOAA server, in that order of preference. The
+ * transport is picked by the first mirror. Over libcurl, at most
+ * opts->maxconn stations are in flight, spread over the mirrors in turn,
+ * with the deadlines of opts. With more than one mirror, a station not
+ * answered within the hedge delay is also asked from the next mirror, and
+ * the first response used, and a failed one is retried from the next
+ * mirror once. Connections are kept
+ * alive and reused between stations. With a cache directory, reports
+ * younger than opts->cachettl seconds are served from it without any
+ * network access, and older ones are revalidated with a conditional
+ * request. For opts->cycles stations or more, the cycle files of the
+ * last FETCH_NCYCLES hours are fetched instead, from the cycles directory
+ * beside a base URL ending in /stations or under any other one, and the
+ * stations are answered with their latest report in them; stations
+ * without one are fetched from their station files. The data is split
+ * into records while it arrives, so a record is handed to opts->record as
+ * soon as its line is complete.
+ * The done callback, unless NULL, is invoked in array order, as soon as a
+ * fetch and all fetches before it have completed; the data of a fetch is
+ * freed after that. Both callbacks get arg. Returns 1 if the transfers
+ * could not be set up. Threads may fetch at the same time, each with its
+ * own fetches.
+ */
+int fetch_Metars(fetch_t *fetches, int count, const fetch_opts_t *opts,
+		 fetch_cb done, void *arg);
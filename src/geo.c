@@ -0,0 +1,213 @@
+/*
+  geo.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "station.h"
+#include "geo.h"
+
+#define ROWS (180 / GEO_CELL)
+#define COLS (360 / GEO_CELL)
+
+#define RAD(deg) ((deg) * M_PI / 180.0)
+#define DEG(rad) ((rad) * 180.0 / M_PI)
+
+/* the grid: the stations of cell c are ids[start[c]] .. ids[start[c+1]-1],
+   cells in rows from the south pole, columns from 180 W */
+static int *start = NULL;
+static int *ids = NULL;
+
+
+/* row and column of a position */
+static int row_of(double lat) {
+  int r = (lat + 90) / GEO_CELL;
+
+  return r < 0 ? 0 : (r >= ROWS ? ROWS - 1 : r);
+}
+
+static int col_of(double lon) {
+  int c;
+
+  lon = fmod(lon + 180, 360);
+  if (lon < 0) lon += 360;
+  c = lon / GEO_CELL;
+  return c >= COLS ? COLS - 1 : c;
+}
+
+
+/* bucket the stations into the grid with a counting sort */
+static void build_grid(void) {
+  const station_t *s;
+  int n = station_count(), i, c;
+
+  start = calloc(ROWS * COLS + 1, sizeof(int));
+  ids = malloc(n * sizeof(int));
+  for (i = 0; i < n; i++) {
+    s = station_get(i);
+    start[row_of(s->lat) * COLS + col_of(s->lon) + 1]++;
+  }
+  for (c = 0; c < ROWS * COLS; c++) start[c + 1] += start[c];
+  for (i = 0; i < n; i++) {
+    s = station_get(i);
+    c = row_of(s->lat) * COLS + col_of(s->lon);
+    ids[start[c]++] = i;
+  }
+  /* start[c] is now where cell c+1 starts */
+  memmove(start + 1, start, ROWS * COLS * sizeof(int));
+  start[0] = 0;
+}
+
+
+/* Call the function for each station in the rows r0..r1 and in the
+ * columns c0..c1, wrapping around when c0 > c1. */
+static void scan_cells(int r0, int r1, int c0, int c1,
+		       void (*fn)(int id, void *arg), void *arg) {
+  int r, c, i;
+
+  if (start == NULL) build_grid();
+  for (r = r0; r <= r1; r++) {
+    for (c = c0; ; c = (c + 1) % COLS) {
+      for (i = start[r * COLS + c]; i < start[r * COLS + c + 1]; i++)
+	fn(ids[i], arg);
+      if (c == c1) break;
+    }
+  }
+}
+
+
+/* PUBLIC--
+ * Great-circle distance with the haversine formula.
+ */
+double geo_distance(double lat1, double lon1, double lat2, double lon2) {
+  double dlat = sin(RAD(lat2 - lat1) / 2), dlon = sin(RAD(lon2 - lon1) / 2);
+  double a = dlat * dlat + cos(RAD(lat1)) * cos(RAD(lat2)) * dlon * dlon;
+
+  return 2 * GEO_RADIUS * asin(sqrt(a < 1 ? a : 1));
+} // geo_distance
+
+
+/* state of a nearest station search */
+typedef struct {
+  double     lat;
+  double     lon;
+  double     radius;	// km, stations further away are ignored
+  int        n;
+  int        found;
+  geo_hit_t *hits;	// nearest first
+} near_t;
+
+/* keep the station if it's among the n nearest within the radius */
+static void near_station(int id, void *arg) {
+  near_t *q = arg;
+  const station_t *s = station_get(id);
+  double d = geo_distance(q->lat, q->lon, s->lat, s->lon);
+  int i;
+
+  if (d > q->radius || (q->found == q->n && d >= q->hits[q->n - 1].distance))
+    return;
+  if (q->found < q->n) q->found++;
+  for (i = q->found - 1; i > 0 && q->hits[i - 1].distance > d; i--)
+    q->hits[i] = q->hits[i - 1];
+  q->hits[i].station = s;
+  q->hits[i].distance = d;
+}
+
+
+/* PUBLIC--
+ * Find the nearest stations. The cells within a radius of the point are
+ * searched, with the radius growing until enough stations are found.
+ */
+int geo_near(double lat, double lon, int n, geo_hit_t *hits) {
+  near_t q = { lat, lon, 50, n, 0, hits };
+  double angle, dlon;
+
+  if (n <= 0) return 0;
+  for (;;) {
+    q.found = 0;
+    angle = q.radius / GEO_RADIUS;
+    if (angle >= M_PI) {
+      /* the whole globe */
+      scan_cells(0, ROWS - 1, 0, COLS - 1, near_station, &q);
+      break;
+    }
+    /* the box around the circle; it spans all longitudes when the
+       circle reaches a pole */
+    if (lat + DEG(angle) >= 90 || lat - DEG(angle) <= -90 ||
+	(dlon = DEG(asin(sin(angle) / cos(RAD(lat))))) >= 180 - GEO_CELL)
+      scan_cells(row_of(lat - DEG(angle)), row_of(lat + DEG(angle)),
+		 0, COLS - 1, near_station, &q);
+    else
+      scan_cells(row_of(lat - DEG(angle)), row_of(lat + DEG(angle)),
+		 col_of(lon - dlon), col_of(lon + dlon), near_station, &q);
+    if (q.found == n) break;
+    q.radius *= 4;
+  }
+  return q.found;
+} // geo_near
+
+
+/* state of a bounding box search */
+typedef struct {
+  double south, west, north, east;
+  int found;
+  const station_t **stations;
+} bbox_t;
+
+/* keep the station if it's inside the box */
+static void bbox_station(int id, void *arg) {
+  bbox_t *q = arg;
+  const station_t *s = station_get(id);
+
+  if (s->lat < q->south || s->lat > q->north) return;
+  if (q->west <= q->east ? (s->lon < q->west || s->lon > q->east)
+      : (s->lon < q->west && s->lon > q->east)) return;
+  q->stations[q->found++] = s;
+}
+
+static int compare_stations(const void *a, const void *b) {
+  const station_t *x = *(const station_t **)a, *y = *(const station_t **)b;
+
+  return (x > y) - (x < y);
+}
+
+
+/* PUBLIC--
+ * Find the stations inside a box.
+ */
+int geo_bbox(double south, double west, double north, double east,
+	     const station_t **found) {
+  bbox_t q = { south, west, north, east, 0, found };
+  double width = (west <= east) ? east - west : east - west + 360;
+
+  if (south > north) return 0;
+  if (width >= 360 - 2 * GEO_CELL)
+    scan_cells(row_of(south), row_of(north), 0, COLS - 1, bbox_station, &q);
+  else
+    scan_cells(row_of(south), row_of(north), col_of(west), col_of(east),
+	       bbox_station, &q);
+  /* the directory is in order of the codes */
+  qsort(found, q.found, sizeof(found[0]), compare_stations);
+  return q.found;
+} // geo_bbox
+
+// EOF
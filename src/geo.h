@@ -0,0 +1,56 @@
+/*
+  geo.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Spatial queries over the station directory. The stations are bucketed
+ * into a grid of GEO_CELL degree cells on first use, so a query only
+ * looks at the cells around the point or inside the box.
+ *
+ * Needs <stdint.h> and station.h.
+ */
+
+/* size of a grid cell in degrees, divides 180 */
+#define GEO_CELL 2
+
+/* mean radius of the earth in km */
+#define GEO_RADIUS 6371.0088
+
+/* a station found and its distance in km */
+typedef struct {
+  const station_t *station;
+  double           distance;
+} geo_hit_t;
+
+/* Great-circle distance in km between two points given in degrees. */
+double geo_distance(double lat1, double lon1, double lat2, double lon2);
+
+/* Find the n stations nearest to lat, lon, nearest first, into hits.
+ * Returns the number found, which is less than n only if the directory
+ * has fewer stations.
+ */
+int geo_near(double lat, double lon, int n, geo_hit_t *hits);
+
+/* Find the stations within the box from south to north and from west to
+ * east, crossing the 180th meridian when west > east. They are stored in
+ * order of their codes into found, which has room for station_count()
+ * entries. Returns the number found.
+ */
+int geo_bbox(double south, double west, double north, double east,
+	     const station_t **found);
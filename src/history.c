@@ -0,0 +1,356 @@
+/*
+  history.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "metar.h"
+#include "record.h"
+#include "history.h"
+
+#define HISTORY_MAGIC "METARHS1"
+#define INDEX_MAGIC   "METARIX1"
+
+/* room for the path of the index */
+#define INDEX_PATHSIZE 1024
+
+/* header of the history file, records follow */
+typedef struct {
+  char     magic[8];
+  uint32_t recsize;
+  uint8_t  reserved[52];
+} history_header_t;
+
+/* header of the index file, the stations and their entries follow */
+typedef struct {
+  char     magic[8];
+  uint64_t nrecs;	// records in the history file when written
+  uint32_t nstations;
+  uint32_t reserved;
+} index_header_t;
+
+typedef char header_size_check[sizeof(history_header_t) ==
+			       sizeof(metar_rec_t) ? 1 : -1];
+
+
+/* PUBLIC--
+ * Open the history file for appending.
+ */
+FILE *history_create(const char *path) {
+  history_header_t header;
+  FILE *fp;
+
+  if ((fp = fopen(path, "ab")) == NULL) {
+    perror(path);
+    return NULL;
+  }
+  if (ftell(fp) == 0) {
+    memset(&header, 0x0, sizeof(header));
+    memcpy(header.magic, HISTORY_MAGIC, 8);
+    header.recsize = sizeof(metar_rec_t);
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+      perror(path);
+      fclose(fp);
+      return NULL;
+    }
+  }
+  return fp;
+} // history_create
+
+
+/* PUBLIC--
+ * Append a record.
+ */
+int history_add(FILE *fp, const metar_rec_t *rec) {
+  return fwrite(rec, sizeof(metar_rec_t), 1, fp) != 1;
+} // history_add
+
+
+static int compare_stations(const void *a, const void *b) {
+  return memcmp(((const history_station_t *)a)->station,
+		((const history_station_t *)b)->station, 4);
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  const history_entry_t *x = a, *y = b;
+
+  if (x->obstime != y->obstime) return (x->obstime < y->obstime) ? -1 : 1;
+  return (x->recno < y->recno) ? -1 : (x->recno > y->recno);
+}
+
+
+/* hash table slot of a station */
+static uint32_t station_slot(const history_station_t *table, uint32_t size,
+			     const char *station) {
+  uint32_t key, slot;
+
+  memcpy(&key, station, 4);
+  for (slot = (key * 2654435761u) & (size - 1);
+       table[slot].count && memcmp(table[slot].station, station, 4);
+       slot = (slot + 1) & (size - 1));
+  return slot;
+}
+
+
+/* build the index of the records: the stations in ICAO order, each with its
+ * entries in time order; NULL if out of memory */
+static void *build_index(const metar_rec_t *recs, size_t nrecs, size_t *size) {
+  history_station_t *table, *tmp, *stations;
+  history_entry_t *entries;
+  index_header_t *header;
+  uint32_t tablesize = 1024, nstations = 0, slot, i;
+  uint64_t first;
+  size_t n;
+  char *index;
+
+  /* count the records of each station */
+  if ((table = calloc(tablesize, sizeof(history_station_t))) == NULL)
+    return NULL;
+  for (n = 0; n < nrecs; n++) {
+    slot = station_slot(table, tablesize, recs[n].station);
+    if (table[slot].count++ == 0) {
+      memcpy(table[slot].station, recs[n].station, 4);
+      if (++nstations * 2 > tablesize) {
+	/* grow the table */
+	if ((tmp = calloc(tablesize * 2, sizeof(history_station_t)))
+	    == NULL) {
+	  free(table);
+	  return NULL;
+	}
+	for (i = 0; i < tablesize; i++)
+	  if (table[i].count)
+	    tmp[station_slot(tmp, tablesize * 2, table[i].station)] = table[i];
+	free(table);
+	table = tmp;
+	tablesize *= 2;
+      }
+    }
+  }
+
+  *size = sizeof(index_header_t) + nstations * sizeof(history_station_t) +
+    nrecs * sizeof(history_entry_t);
+  if ((index = calloc(1, *size)) == NULL) {
+    free(table);
+    return NULL;
+  }
+  header = (index_header_t *)index;
+  stations = (history_station_t *)(header + 1);
+  entries = (history_entry_t *)(stations + nstations);
+
+  memcpy(header->magic, INDEX_MAGIC, 8);
+  header->nrecs = nrecs;
+  header->nstations = nstations;
+
+  for (i = 0, n = 0; i < tablesize; i++)
+    if (table[i].count) stations[n++] = table[i];
+  qsort(stations, nstations, sizeof(history_station_t), compare_stations);
+  for (i = 0, first = 0; i < nstations; i++) {
+    stations[i].first = first;
+    first += stations[i].count;
+    stations[i].count = 0;
+  }
+
+  /* reuse the hash table to map stations to their place in the index */
+  for (i = 0; i < nstations; i++) {
+    slot = station_slot(table, tablesize, stations[i].station);
+    table[slot].first = i;
+  }
+  for (n = 0; n < nrecs; n++) {
+    slot = station_slot(table, tablesize, recs[n].station);
+    i = table[slot].first;
+    entries[stations[i].first + stations[i].count].obstime = recs[n].obstime;
+    entries[stations[i].first + stations[i].count].recno = n;
+    stations[i].count++;
+  }
+  free(table);
+
+  /* records are mostly added in time order, sort only what isn't */
+  for (i = 0; i < nstations; i++) {
+    history_entry_t *e = entries + stations[i].first;
+    for (n = 1; n < stations[i].count; n++)
+      if (compare_entries(&e[n-1], &e[n]) > 0) break;
+    if (n < stations[i].count)
+      qsort(e, stations[i].count, sizeof(history_entry_t), compare_entries);
+  }
+
+  return index;
+}
+
+
+/* write the index next to the history file, replacing the old one only
+ * once the new one is wholly written */
+static void write_index(const char *idxpath, const void *index, size_t size) {
+  char tmp[INDEX_PATHSIZE + 4];
+  FILE *fp;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", idxpath);
+  if ((fp = fopen(tmp, "wb")) == NULL) return;
+  if (fwrite(index, size, 1, fp) != 1) {
+    fclose(fp);
+    remove(tmp);
+    return;
+  }
+  if (fclose(fp) || rename(tmp, idxpath)) remove(tmp);
+}
+
+
+/* PUBLIC--
+ * Map the history file and its index.
+ */
+int history_open(history_t *h, const char *path) {
+  const history_header_t *header;
+  const index_header_t *ih;
+  char idxpath[INDEX_PATHSIZE];
+  struct stat st;
+  int fd;
+
+  memset(h, 0x0, sizeof(history_t));
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st)) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+  if (st.st_size < sizeof(history_header_t) ||
+      (h->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+      == MAP_FAILED) {
+    fprintf(stderr, "%s: not a history file\n", path);
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  h->mapsize = st.st_size;
+
+  header = h->map;
+  if (memcmp(header->magic, HISTORY_MAGIC, 8) ||
+      header->recsize != sizeof(metar_rec_t)) {
+    fprintf(stderr, "%s: not a history file\n", path);
+    history_close(h);
+    return 1;
+  }
+  /* a partially written last record is ignored */
+  h->recs = (const metar_rec_t *)(header + 1);
+  h->nrecs = (st.st_size - sizeof(history_header_t)) / sizeof(metar_rec_t);
+
+  /* use the index if it is up to date and whole, otherwise rebuild it */
+  if (snprintf(idxpath, sizeof(idxpath), "%s.idx", path) >=
+      (int)sizeof(idxpath)) idxpath[0] = 0;
+  if (idxpath[0] && (fd = open(idxpath, O_RDONLY)) >= 0) {
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(index_header_t) &&
+	(h->index = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+	!= MAP_FAILED) {
+      h->indexsize = st.st_size;
+      h->indexmapped = 1;
+      ih = h->index;
+      if (memcmp(ih->magic, INDEX_MAGIC, 8) || ih->nrecs != h->nrecs ||
+	  (uint64_t)st.st_size != sizeof(index_header_t) +
+	  (uint64_t)ih->nstations * sizeof(history_station_t) +
+	  ih->nrecs * sizeof(history_entry_t)) {
+	munmap(h->index, h->indexsize);
+	h->index = NULL;
+      }
+    } else {
+      h->index = NULL;
+    }
+    close(fd);
+  }
+  if (h->index == NULL) {
+    h->indexmapped = 0;
+    if ((h->index = build_index(h->recs, h->nrecs, &h->indexsize)) == NULL) {
+      fprintf(stderr, "%s: out of memory for the index\n", path);
+      history_close(h);
+      return 1;
+    }
+    if (idxpath[0]) write_index(idxpath, h->index, h->indexsize);
+  }
+
+  ih = h->index;
+  h->nstations = ih->nstations;
+  h->stations = (const history_station_t *)(ih + 1);
+  h->entries = (const history_entry_t *)(h->stations + h->nstations);
+  return 0;
+} // history_open
+
+
+/* PUBLIC--
+ * Hand all records over to the callback.
+ */
+size_t history_scan(const history_t *h, history_cb cb, void *arg) {
+  size_t n;
+
+  for (n = 0; n < h->nrecs; n++)
+    cb(&h->recs[n], arg);
+  return n;
+} // history_scan
+
+
+/* PUBLIC--
+ * Hand the records of a station between from and to over to the callback.
+ */
+size_t history_query(const history_t *h, const char *station,
+		     time_t from, time_t to, history_cb cb, void *arg) {
+  const history_station_t *st;
+  const history_entry_t *e;
+  history_station_t key;
+  size_t lo, hi, mid, n = 0;
+
+  memset(&key, 0x0, sizeof(key));
+  memcpy(key.station, station, strnlen(station, 4));
+  st = bsearch(&key, h->stations, h->nstations, sizeof(history_station_t),
+	       compare_stations);
+  /* the entries of a station, and their records, are within the index */
+  if (st == NULL || st->first > h->nrecs || st->count > h->nrecs - st->first)
+    return 0;
+
+  /* first entry at or after from */
+  e = h->entries + st->first;
+  for (lo = 0, hi = st->count; lo < hi; ) {
+    mid = (lo + hi) / 2;
+    if (e[mid].obstime < from) lo = mid + 1;
+    else hi = mid;
+  }
+
+  for (; lo < st->count && e[lo].obstime <= to; lo++) {
+    if (e[lo].recno >= h->nrecs) continue;
+    cb(&h->recs[e[lo].recno], arg);
+    n++;
+  }
+  return n;
+} // history_query
+
+
+/* PUBLIC--
+ * Unmap the history file.
+ */
+void history_close(history_t *h) {
+  if (h->index) {
+    if (h->indexmapped) munmap(h->index, h->indexsize);
+    else free(h->index);
+  }
+  if (h->map) munmap(h->map, h->mapsize);
+  memset(h, 0x0, sizeof(history_t));
+} // history_close
@@ -0,0 +1,78 @@
+/*
+  history.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* index entries of a station, sorted by observation time */
+typedef struct {
+  char     station[4];
+  uint32_t count;
+  uint64_t first;	// index of the first entry
+} history_station_t;
+
+typedef struct {
+  uint32_t obstime;
+  uint32_t recno;
+} history_entry_t;
+
+/* an opened history file and its index */
+typedef struct {
+  const metar_rec_t *recs;
+  size_t   nrecs;
+  const history_station_t *stations;
+  uint32_t nstations;
+  const history_entry_t *entries;
+  void    *map;		// mapping of the history file
+  size_t   mapsize;
+  void    *index;	// mapping or copy of the index
+  size_t   indexsize;
+  int      indexmapped;
+} history_t;
+
+/* called for each record found */
+typedef void (*history_cb)(const metar_rec_t *rec, void *arg);
+
+/* Open the history file for appending records, creating it if needed.
+ * Returns NULL on failure.
+ */
+FILE *history_create(const char *path);
+
+/* Append a record to the history file. Returns 1 on failure. */
+int history_add(FILE *fp, const metar_rec_t *rec);
+
+/* Map the history file for queries. The per-station time index is kept
+ * next to it in path.idx and rebuilt when records have been appended
+ * since it was written. Returns 1 on failure.
+ */
+int history_open(history_t *h, const char *path);
+
+/* Hand all records over to the callback, in the order they were added.
+ * Returns the number of records.
+ */
+size_t history_scan(const history_t *h, history_cb cb, void *arg);
+
+/* Hand the records of a station observed between from and to (inclusive)
+ * over to the callback in time order, found through the index. Returns the
+ * number of records.
+ */
+size_t history_query(const history_t *h, const char *station,
+		     time_t from, time_t to, history_cb cb, void *arg);
+
+/* Unmap the history file. */
+void history_close(history_t *h);
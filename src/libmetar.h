@@ -0,0 +1,59 @@
+/*
+  libmetar.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* The public interface of libmetar, for programs which decode reports in
+ * process instead of running metar:
+ *
+ *   fetch_opts_init(), fetch_Metars()   fetch.h, the NOAA data of stations
+ *   parse_NOAA_data_r()                 metar.h, the report of NOAA data
+ *   metar_ctx_init(), parse_Metar_r()   metar.h, decode a report
+ *   metar_format(), metar_free()        output.h, format a decoded report
+ *   metar_batch_decode()                batch.h, decode reports into columns
+ *
+ * A decoded report owns no memory and needs no freeing, only the strings
+ * of metar_format() do. The functions taking a context or options touch
+ * no global state and may be called from several threads. Compile and
+ * link with the flags of `pkg-config --cflags --libs libmetar`.
+ */
+#ifndef LIBMETAR_H
+#define LIBMETAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define LIBMETAR_VERSION "1.95"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "metar.h"
+#include "output.h"
+#include "fetch.h"
+#include "batch.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,15 +22,25 @@
 #include <ctype.h>
 #include <curl/curl.h>
 #include <sys/types.h>
-#include <regex.h>
 #include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "metar.h"
-
-/* global variable so we dont have to mess with parameter passing */
-char noaabuffer[METAR_MAXSIZE];
+#include "record.h"
+#include "history.h"
+#include "fetch.h"
+#include "output.h"
+#include "bulk.h"
+#include "daemon.h"
+#include "station.h"
+#include "geo.h"
+#include "stats.h"
+#include "ring.h"
 
 /* command line args; everything unset at default */
 int rawmetar=0;
@@ -39,14 +49,70 @@ int shortdecode=0;
 int verbose=0;
 int noconvert=0;
 int extra=0;
-
-/** wind unit conversion variables to be made in metar.c **/
- /* from? if this matches, the conversion will be made */
- const char wind_convfrom[5] = "KT";
- /* to? if you change this, make sure your unit fits into char windunit[5]: */
- const char wind_convto[5] = "m/s";
- /* what is the conversion factor? */
- const float wind_convfac = 0.514444;
+int files=0;
+int daemonize=0;
+int showstats=0;
+int nthreads=0;
+int queuesize=RING_SIZE;
+char *histfile=NULL;
+char *queryfile=NULL;
+FILE *history=NULL;
+int format=0;
+unsigned int fields=METAR_F_ALL;
+
+/* stations asked for by position, see --near and --bbox */
+typedef struct {
+  int    nearest;	// number of stations nearest to lat, lon
+  double lat, lon;
+  int    bbox;		// stations in the box
+  double south, west, north, east;
+} area_t;
+
+/* all output goes through the buffer */
+outbuf_t ob;
+int nformatted=0;
+
+/* long options without a short equivalent */
+enum {
+  OPT_DAEMON = 256,
+  OPT_SOCKET,
+  OPT_INTERVAL,
+  OPT_POLL,
+  OPT_HISTORY,
+  OPT_QUERY,
+  OPT_FROM,
+  OPT_TO,
+  OPT_NEAR,
+  OPT_BBOX,
+  OPT_FIELDS,
+  OPT_STATS,
+  OPT_CONNECT_TIMEOUT,
+  OPT_TIMEOUT,
+  OPT_HEDGE,
+  OPT_QUEUE,
+  OPT_CYCLES
+};
+
+static struct option longopts[] = {
+  {"daemon", no_argument, NULL, OPT_DAEMON},
+  {"socket", required_argument, NULL, OPT_SOCKET},
+  {"interval", required_argument, NULL, OPT_INTERVAL},
+  {"poll", required_argument, NULL, OPT_POLL},
+  {"history", required_argument, NULL, OPT_HISTORY},
+  {"query", required_argument, NULL, OPT_QUERY},
+  {"from", required_argument, NULL, OPT_FROM},
+  {"to", required_argument, NULL, OPT_TO},
+  {"near", required_argument, NULL, OPT_NEAR},
+  {"bbox", required_argument, NULL, OPT_BBOX},
+  {"fields", required_argument, NULL, OPT_FIELDS},
+  {"stats", no_argument, NULL, OPT_STATS},
+  {"connect-timeout", required_argument, NULL, OPT_CONNECT_TIMEOUT},
+  {"timeout", required_argument, NULL, OPT_TIMEOUT},
+  {"hedge", required_argument, NULL, OPT_HEDGE},
+  {"queue", required_argument, NULL, OPT_QUEUE},
+  {"cycles", required_argument, NULL, OPT_CYCLES},
+  {NULL, 0, NULL, 0}
+};
 
 
 char *strupc(char *line) {
@@ -57,208 +123,601 @@ char *strupc(char *line) {
 
 /* show brief usage info */
 void usage(char *name) {
+  metar_ctx_t ctx;
+
+  metar_ctx_init(&ctx);
   printf("metar 1.95 %s %s\n", __DATE__, __TIME__);
   printf("Usage: %s [options] stations\n", name);
+  printf("       %s [options] -f files\n", name);
+  printf("       %s [options] --daemon stations\n", name);
+  printf("       %s [options] --query file [stations]\n", name);
+  printf("       %s [options] --near lat,lon[,n] | --bbox s,w,n,e [stations]\n",
+	 name);
   printf("Options\n");
   printf("   -b        decode briefly (default)\n");
+  printf("   -c dir    cache reports in dir\n");
   printf("   -d        decode METAR\n");
   printf("   -e        decode briefly with extra information\n");
+  printf("   -f        decode all reports in NOAA data files, - for stdin\n");
   printf("   -h        show this help\n");
+  printf("   -j num    fetch at most num stations in parallel (default %d)\n",
+	 FETCH_MAXCONN);
+  printf("   -J num    decode files on num threads (default the number of\n");
+  printf("             CPUs)\n");
   printf("   -n        don't convert wind from %s to %s\n",
-	 wind_convfrom, wind_convto);
+	 ctx.wind_convfrom, ctx.wind_convto);
+  printf("   -o fmt    print reports as json, ndjson or csv\n");
   printf("   -r        print raw METAR data\n");
+  printf("   -t secs   use cached reports for secs seconds (default %d)\n",
+	 FETCH_CACHETTL);
+  printf("   -u url    fetch the station files from url, file://dir for a\n");
+  printf("             local mirror or - for NOAA data on stdin; repeat\n");
+  printf("             for mirrors\n");
   printf("   -v        be verbose\n");
+  printf("   --fields list\n");
+  printf("             decode only the fields listed: time, wind, vis, temp,\n");
+  printf("             qnh, clouds, weather, other\n");
+  printf("   --connect-timeout secs, --timeout secs\n");
+  printf("             give up connecting or fetching a station after secs\n");
+  printf("             (default %g and %g, 0 for no limit)\n",
+	 FETCH_CONNECTTIMEOUT / 1000.0, FETCH_TIMEOUT / 1000.0);
+  printf("   --hedge secs|auto\n");
+  printf("             ask the next mirror too after secs, 0 for never\n");
+  printf("             (default auto, the p95 of the fetch times)\n");
+  printf("   --cycles num\n");
+  printf("             fetch the hourly cycle files instead of the station\n");
+  printf("             files for num stations or more (default %d, 0 for\n",
+	 FETCH_CYCLES);
+  printf("             never)\n");
+  printf("   --queue num\n");
+  printf("             slots between the fetching, decoding and printing\n");
+  printf("             threads (default %d, 0 to do all on one thread)\n",
+	 RING_SIZE);
+  printf("   --stats   print the time spent in each stage to stderr\n");
+  printf("   --daemon  keep stations fresh and answer queries on a socket\n");
+  printf("   --socket path\n");
+  printf("             socket of the daemon (default %s)\n", DAEMON_SOCKET);
+  printf("   --interval secs\n");
+  printf("             seconds between refreshes in the daemon (default %d)\n",
+	 DAEMON_INTERVAL);
+  printf("   --poll fixed|adaptive\n");
+  printf("             poll all stations every interval, or each one when\n");
+  printf("             its next report is due (default adaptive)\n");
+  printf("   --history file\n");
+  printf("             append the decoded reports to the history file\n");
+  printf("   --query file\n");
+  printf("             print the reports stored in the history file\n");
+  printf("   --from time, --to time\n");
+  printf("             limit the query to reports observed in between,\n");
+  printf("             time as YYYY/MM/DD [HH:MM] UTC or seconds since 1970\n");
+  printf("   --near lat,lon[,n]\n");
+  printf("             add the n stations nearest to the position\n");
+  printf("             (default 1)\n");
+  printf("   --bbox south,west,north,east\n");
+  printf("             add the stations within the box, in degrees\n");
   printf("Example: %s -d efjy\n", name);
 }
 
 
-/* place NOAA data in buffer */
-int receiveData(void *buffer, size_t size, size_t nmemb, void *stream) {
-  size *= nmemb;
-  size = (size <= METAR_MAXSIZE) ? size : METAR_MAXSIZE;
-  strncpy(noaabuffer, buffer, size);
-  return size;
+/* parse seconds, possibly with a fraction, into ms; returns 1 if they are
+   invalid */
+int parse_secs(const char *s, long *ms) {
+  char *end;
+  double secs;
+
+  secs = strtod(s, &end);
+  if (end == s || *end || secs < 0 || secs > 86400) return 1;
+  *ms = secs * 1000 + 0.5;
+  return 0;
 }
 
 
-/* fetch NOAA report */
-int download_Metar(char *station) {
-  CURL *curlhandle = NULL;
-  CURLcode res;
-  char url[URL_MAXSIZE];
-  char tmp[URL_MAXSIZE];
-  curlhandle = curl_easy_init();
-  if (!curlhandle) return 1;
+/* parse --near lat,lon[,n], returns 1 if it's invalid */
+int parse_near(const char *s, area_t *area) {
+  char c;
+  int n;
 
-  memset(tmp, 0x0, URL_MAXSIZE);
-  if (getenv("METARURL") == NULL) {
-    strncpy(tmp, METARURL, URL_MAXSIZE);
-  } else {
-    strncpy(tmp, getenv("METARURL"), URL_MAXSIZE);
-    if (verbose) printf("Using environment variable METARURL: %s\n", tmp);
+  area->nearest = 1;
+  n = sscanf(s, "%lf,%lf%c%d%c", &area->lat, &area->lon, &c,
+	     &area->nearest, &c);
+  /* there are never more hits than stations */
+  if (area->nearest > station_count()) area->nearest = station_count();
+  if ((n != 2 && !(n == 4 && c == ',')) || area->nearest < 1 ||
+      area->lat < -90 || area->lat > 90 ||
+      area->lon < -180 || area->lon > 180) return 1;
+  return 0;
+}
+
+
+/* parse --bbox south,west,north,east, returns 1 if it's invalid */
+int parse_bbox(const char *s, area_t *area) {
+  char c;
+
+  if (sscanf(s, "%lf,%lf,%lf,%lf%c", &area->south, &area->west,
+	     &area->north, &area->east, &c) != 4 ||
+      area->south < -90 || area->north > 90 || area->south > area->north ||
+      area->west < -180 || area->west > 180 ||
+      area->east < -180 || area->east > 180) return 1;
+  area->bbox = 1;
+  return 0;
+}
+
+
+/* The stations given followed by the stations of the area. The array and
+   the codes of the area are allocated. NULL if out of memory. */
+char **area_stations(const area_t *area, char **given, int count,
+		     int *total) {
+  const station_t **found;
+  geo_hit_t *hits;
+  char **stations;
+  int i, n = 0, size;
+
+  size = count + station_count() + area->nearest;
+  if ((stations = malloc(size * sizeof(char *))) == NULL) return NULL;
+  for (i = 0; i < count; i++) stations[n++] = given[i];
+
+  if (area->nearest) {
+    if ((hits = malloc(area->nearest * sizeof(geo_hit_t))) == NULL) {
+      free(stations);
+      return NULL;
+    }
+    count = geo_near(area->lat, area->lon, area->nearest, hits);
+    for (i = 0; i < count; i++) {
+      if (verbose) printf("Station %s at %.1f km\n", hits[i].station->icao,
+			  hits[i].distance);
+      stations[n++] = strdup(hits[i].station->icao);
+    }
+    free(hits);
+  }
+  if (area->bbox) {
+    if ((found = malloc(station_count() * sizeof(station_t *))) == NULL) {
+      free(stations);
+      return NULL;
+    }
+    count = geo_bbox(area->south, area->west, area->north, area->east,
+		     found);
+    if (count == 0) fprintf(stderr, "No stations in the box.\n");
+    for (i = 0; i < count; i++) stations[n++] = strdup(found[i]->icao);
+    free(found);
   }
+  *total = n;
+  return stations;
+}
 
-  if (snprintf(url, URL_MAXSIZE, "%s/%s.TXT", tmp, strupc(station)) < 0)
-    return 1;
-  if (verbose) printf("Retrieving URL %s\n", url);
 
-  curl_easy_setopt(curlhandle, CURLOPT_URL, url);
-  curl_easy_setopt(curlhandle, CURLOPT_WRITEFUNCTION, receiveData);
-  memset(noaabuffer, 0x0, METAR_MAXSIZE);
+/* Upper-case the stations and drop the ones which can't be ICAO codes,
+   before anything is fetched. Returns the number of stations left and
+   sets *bad if any were dropped. */
+int check_stations(char **stations, int count, int *bad) {
+  int i, n = 0;
+
+  for (i = 0; i < count; i++) {
+    if (!station_valid(stations[i])) {
+      fprintf(stderr, "Invalid station %s.\n", stations[i]);
+      *bad = 1;
+      continue;
+    }
+    strupc(stations[i]);
+    if (verbose && station_lookup(stations[i]) == NULL)
+      printf("Station %s is not in the station directory\n", stations[i]);
+    stations[n++] = stations[i];
+  }
+  return n;
+}
 
-  res = curl_easy_perform(curlhandle);
-  curl_easy_cleanup(curlhandle);
 
-  if (res == 0) return 0;
-  else {
-    fprintf(stderr, "CURL error %i while retrieving URL\n", res);
-    return 1;
+/* parse a time given as YYYY/MM/DD [HH:MM] in UTC or as seconds since
+   the epoch, -1 if it's neither */
+time_t parse_time(const char *s) {
+  struct tm tm;
+  char *end;
+  long secs;
+  int n;
+
+  memset(&tm, 0x0, sizeof(tm));
+  n = sscanf(s, "%d/%d/%d %d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+	     &tm.tm_hour, &tm.tm_min);
+  if (n == 3 || n == 5) {
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return timegm(&tm);
   }
+  secs = strtol(s, &end, 10);
+  if (end != s && *end == 0 && secs >= 0) return secs;
+  return -1;
 }
 
 
-/* decode metar */
-void decode_Metar(metar_t metar) {
-  cloudlist_t *curcloud;
-  obslist_t   *curobs;
-  stufflist_t *curstuff;
-  int n = 0;
-  int m = 0;
-  double qnh;
-
-  printf("Station       : %s\n", metar.station);
-  printf("Day           : %i\n", metar.day);
-  printf("Time          : %02i:%02i UTC\n", metar.time/100, metar.time%100);
-  if (metar.winddir == -1) {
-    printf("Wind direction: Variable\n");
-  } else {
-    static const char *winddirs[] = {
-      "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
-      "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW"
-    };
-    n = ((metar.winddir * 4 + 45) / 90) % 16;
-    printf("Wind direction: %i (%s)\n", metar.winddir, winddirs[n]);
+/* print out a report in the machine-readable format, with the start of
+   the output if it's the first one */
+void print_formatted(outbuf_t *out, const metar_t *metar, int first) {
+  switch (format) {
+  case OUTPUT_JSON:
+    outbuf_puts(out, first ? "[\n" : ",\n");
+    json_Metar(out, metar);
+    break;
+  case OUTPUT_NDJSON:
+    json_Metar(out, metar);
+    outbuf_putc(out, '\n');
+    break;
+  case OUTPUT_CSV:
+    if (first) csv_header(out, fields);
+    csv_Metar(out, metar);
+    break;
   }
-  printf("Wind speed    : %.1f %s\n", metar.windstr, metar.windunit);
-  if (metar.windstr != metar.windgust) {
-  printf("Wind gust     : %.1f %s\n", metar.windgust, metar.windunit);
+}
+
+
+/* finish the output, returns 1 if it couldn't be written */
+int finish_output(void) {
+  outbuf_t sb;
+  int res;
+
+  if (format == OUTPUT_JSON) outbuf_puts(&ob, nformatted ? "\n]\n" : "[]\n");
+  res = outbuf_flush(&ob);
+  if (fflush(stdout)) res = 1;
+
+  /* the statistics don't mix with the reports */
+  if (showstats) {
+    outbuf_init(&sb, stderr);
+    stats_prometheus(&sb);
+    outbuf_flush(&sb);
+    outbuf_free(&sb);
   }
+  return res;
+}
 
-  /* visibility: treat 9999 m specially */
-  if (metar.vis == -1) {
-    printf("Visibility    : > 10 km\n");
-  } else {
-    printf("Visibility    : %i %s\n", metar.vis, metar.visunit);
-  }
-  printf("Temperature   : %i C\n", metar.temp);
-  printf("Dewpoint      : %i C\n", metar.dewp);
-
-  qnh = metar.qnh;
-  for (n = 0; n < metar.qnhfp; n++)
-    qnh /= 10.0;
-  printf("Pressure      : %.*f %s\n", metar.qnhfp, qnh, metar.qnhunit);
-
-  printf("Clouds        : ");
-  n = 0;
-  for (curcloud = metar.clouds; curcloud != NULL; curcloud=curcloud->next) {
-    if (n++ == 0) printf("%s at %d00 ft\n",
-			 curcloud->cloud->type, curcloud->cloud->level);
-    else printf("%15s %s at %d00 ft\n",
-		" ",curcloud->cloud->type, curcloud->cloud->level);
-  }
-  if (!n) printf("\n");
-
-  printf("Conditions    : ");
-  n = 0;
-  for (curobs = metar.obs; curobs != NULL; curobs=curobs->next) {
-    if (n++ == 0) printf("%s\n", curobs->obs);
-    else printf("%15s %s\n", " ",curobs->obs);
-  }
-  m = 0;
-  for (curstuff = metar.stuff; curstuff != NULL; curstuff=curstuff->next) {
-    if (m++ == 0) printf("%s\n", curstuff->stuff);
-    else printf("%15s %s\n", " ",curstuff->stuff);
-  }
-    if (!n && !m) printf("\n");
+
+/* Format a report into out in the requested formats, and pack it for the
+   history into rec if it's given; date is the NOAA date line of the
+   report or NULL. Returns the length of out before the machine-readable
+   format. This is called on the decoding threads too, so it only writes
+   to its arguments. */
+size_t output_report(const metar_ctx_t *ctx, const char *date,
+		     size_t datelen, const char *report, size_t len,
+		     outbuf_t *out, int first, metar_rec_t *rec) {
+  metar_t metar;
+  uint64_t start;
+  size_t mark;
+
+  stats_count(STAT_REPORTS, 1);
+  if (decode|shortdecode|format|(rec != NULL)) {
+    start = stats_start();
+    parse_Metar_n(ctx, report, len, &metar);
+    stats_stop(STAT_PARSE, start);
+  }
+  if (rec) {
+    metar_pack(&metar, metar_obstime(date, datelen, &metar, time(NULL)),
+	       rec);
+  }
+  start = stats_start();
+  if (rawmetar) {
+    outbuf_write(out, report, len);
+    outbuf_putc(out, '\n');
+  }
+  if (decode) {
+    decode_Metar(out, &metar);
+  }
+  if (shortdecode) {
+    shortdecode_Metar(out, &metar, extra);
+  }
+  mark = out->len;
+  if (format) {
+    print_formatted(out, &metar, first);
+  }
+  stats_stop(STAT_OUTPUT, start);
+  return mark;
+}
+
+
+/* print out a report in the requested formats, and store it in the
+   history if asked */
+void print_report(const metar_ctx_t *ctx, const char *date, size_t datelen,
+		  const char *report, size_t len) {
+  metar_rec_t rec;
+
+  output_report(ctx, date, datelen, report, len, &ob, nformatted == 0,
+		history ? &rec : NULL);
+  if (format) nformatted++;
+  if (history) history_add(history, &rec);
+  /* keep the output in order with the parser's messages */
+  if (ctx->verbose) outbuf_flush(&ob);
 }
 
 
-/* decode METAR without line breaks */
-void shortdecode_Metar(metar_t metar) {
-  cloudlist_t *curcloud;
-  obslist_t *curobs;
-  stufflist_t *curstuff;
-  int n = 0;
-  double qnh;
+/* print out a record of a bulk input */
+void print_record(const noaa_rec_t *rec, void *arg) {
+  print_report(arg, rec->date, rec->datelen, rec->report, rec->reportlen);
+}
+
 
-  printf("%s day %i time %02i:%02i UTC", metar.station, metar.day, metar.time/100, metar.time%100);
-  printf(", temp %i C", metar.temp);
-  printf(", ");
+/* Format a record of a bulk input into the output of its chunk, on a
+   decoding thread. The reports are formatted as if they weren't the first
+   ones; the mark tells merge_records() where the first one starts. */
+void decode_record(const noaa_rec_t *rec, bulk_out_t *out, void *arg) {
+  metar_rec_t hrec;
+  size_t mark;
 
-  /* if wind gust is different from wind str, include indication */
-  if (metar.windgust != metar.windstr) printf("gusty ");
+  mark = output_report(arg, rec->date, rec->datelen, rec->report,
+		       rec->reportlen, &out->text, 0, history ? &hrec : NULL);
+  if (format && out->count++ == 0) out->mark = mark;
+  if (history) outbuf_write(&out->data, (char *)&hrec, sizeof(hrec));
+}
 
-  printf("wind %.1f %s", metar.windstr, metar.windunit);
 
-  if (metar.winddir != -1) {
-    static const char *winddirs[] = {
-      "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
-      "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW"
-    };
-    n = ((metar.winddir * 4 + 45) / 90) % 16;
-    printf(" from %s", winddirs[n]);
+/* print out the output of a chunk, with the start of the machine-readable
+   output if the chunk has the first report, and add its records to the
+   history */
+void merge_records(bulk_out_t *out, void *arg) {
+  const metar_ctx_t *ctx = arg;
+  size_t i, mark = out->mark;
+
+  if (nformatted == 0 && out->count) {
+    outbuf_write(&ob, out->text.buf, mark);
+    if (format == OUTPUT_JSON) {
+      outbuf_puts(&ob, "[\n");
+      mark += 2;	// past the ",\n" of the report
+    } else if (format == OUTPUT_CSV) {
+      csv_header(&ob, fields);
+    }
+    outbuf_write(&ob, out->text.buf + mark, out->text.len - mark);
+  } else {
+    outbuf_write(&ob, out->text.buf, out->text.len);
   }
+  nformatted += out->count;
+
+  for (i = 0; i + sizeof(metar_rec_t) <= out->data.len;
+       i += sizeof(metar_rec_t))
+    history_add(history, (const metar_rec_t *)(out->data.buf + i));
+  if (ctx->verbose) outbuf_flush(&ob);
+}
 
-  if (extra) {
-    qnh = metar.qnh;
-    for (n = 0; n < metar.qnhfp; n++)
-      qnh /= 10.0;
-    printf(", ");
-    printf("pressure %.*f %s", metar.qnhfp, qnh, metar.qnhunit);
+
+/* print out why a station has no report */
+void print_missing(outbuf_t *out, const char *station, int status) {
+  if (status == 0) {
+    /* an empty file or an error page instead of the station file */
+    outbuf_printf(out, "METAR station %s not found in NOAA data.\n",
+		  station);
+  } else {
+    /* fetch_Metars() prints the error code of CURL if something has
+       gone wrong */
+    outbuf_puts(out, "METAR data download failed.\n");
   }
+}
+
+
+/* print out the report of a fetched station */
+void print_Metar(fetch_t *fetch, void *arg) {
 
-  /* print observations */
-  for (curobs = metar.obs; curobs != NULL; curobs=curobs->next) {
-    printf(", %s", curobs->obs);
+  /* if successfully downloaded and the NOAA data had a report, parse it
+     if needed and print stuff out */
+  if (fetch->status == 0 && fetch->nrecords) {
+    print_record(&fetch->rec, arg);
+  } else {
+    print_missing(&ob, fetch->station, fetch->status);
   }
+  outbuf_flush(&ob);
+  fflush(stdout);
+}
+
+
+/* A fetched station on its way from the fetching stage to the decoding
+   one. The fetch is freed once handed over, so the record is copied. */
+typedef struct {
+  char   station[10];
+  int    status;	// of the fetch
+  int    found;		// 1 if the data had a report
+  size_t datelen;
+  size_t len;
+  char   text[];	// the date line, if any, and the report
+} fetched_t;
+
+/* the stages of the fetch pipeline: this thread fetches, one decodes and
+   formats the reports, and one prints them out */
+typedef struct {
+  const metar_ctx_t *ctx;
+  ring_t decodeq;	// fetched_t waiting to be decoded
+  ring_t outputq;	// bulk_out_t waiting to be printed
+} pipeline_t;
+
+
+/* hand a fetched station over to the decoding stage, waiting while it's
+   queuesize stations behind */
+void queue_Metar(fetch_t *fetch, void *arg) {
+  pipeline_t *pipe = arg;
+  const noaa_rec_t *rec = &fetch->rec;
+  fetched_t *item;
+
+  item = malloc(sizeof(fetched_t) + rec->datelen + rec->reportlen);
+  memcpy(item->station, fetch->station, sizeof(item->station));
+  item->status = fetch->status;
+  item->found = fetch->nrecords > 0;
+  item->datelen = rec->datelen;
+  item->len = rec->reportlen;
+  if (rec->date) memcpy(item->text, rec->date, rec->datelen);
+  if (rec->report)
+    memcpy(item->text + rec->datelen, rec->report, rec->reportlen);
+  ring_push(&pipe->decodeq, item);
+}
 
-  if (extra) {
-    if (metar.vis == -1) {
-      printf(", visibility over 10 km");
+
+/* decode and format the fetched stations until the fetching is done */
+void *decode_stage(void *arg) {
+  pipeline_t *pipe = arg;
+  fetched_t *item;
+  bulk_out_t *out;
+  noaa_rec_t rec;
+
+  while ((item = ring_pop(&pipe->decodeq)) != NULL) {
+    out = malloc(sizeof(bulk_out_t));
+    outbuf_init(&out->text, NULL);
+    outbuf_init(&out->data, NULL);
+    out->count = 0;
+    out->mark = (size_t)-1;
+
+    if (item->status == 0 && item->found) {
+      memset(&rec, 0x0, sizeof(rec));
+      if (item->datelen) rec.date = item->text;
+      rec.datelen = item->datelen;
+      rec.report = item->text + item->datelen;
+      rec.reportlen = item->len;
+      decode_record(&rec, out, (void *)pipe->ctx);
     } else {
-      printf(", visibility %i %s", metar.vis, metar.visunit);
+      print_missing(&out->text, item->station, item->status);
     }
+    free(item);
+    ring_push(&pipe->outputq, out);
+  }
+  ring_close(&pipe->outputq);
+  return NULL;
+}
+
+
+/* print out the formatted stations, flushing whenever none are waiting */
+void *output_stage(void *arg) {
+  pipeline_t *pipe = arg;
+  bulk_out_t *out;
 
-    for (curstuff = metar.stuff; curstuff != NULL; curstuff=curstuff->next) {
-      printf(", %s", curstuff->stuff);
+  for (;;) {
+    if ((out = ring_trypop(&pipe->outputq)) == NULL) {
+      outbuf_flush(&ob);
+      fflush(stdout);
+      if ((out = ring_pop(&pipe->outputq)) == NULL) break;
     }
+    merge_records(out, (void *)pipe->ctx);
+    outbuf_free(&out->text);
+    outbuf_free(&out->data);
+    free(out);
+  }
+  return NULL;
+}
+
 
-    n = 0;
-    for (curcloud = metar.clouds; curcloud != NULL; curcloud=curcloud->next) {
-      if (n++ == 0) printf(", clouds: %s at %d00 ft;",
-			   curcloud->cloud->type, curcloud->cloud->level);
-      else printf(" %s at %d00 ft;",
-		  curcloud->cloud->type, curcloud->cloud->level);
+/* Fetch the stations, decoding and printing out the reports on threads of
+   their own as they arrive, so that neither the network nor the CPU waits
+   for the other. Returns 1 if the transfers could not be set up. */
+int pipeline_Metars(fetch_t *fetches, int count, const fetch_opts_t *opts,
+		    const metar_ctx_t *ctx) {
+  pipeline_t pipe;
+  pthread_t decoder, printer;
+  queue_stats_t qs;
+  int res, started = 0;
+
+  pipe.ctx = ctx;
+  if (ring_init(&pipe.decodeq, queuesize) ||
+      ring_init(&pipe.outputq, queuesize))
+    return fetch_Metars(fetches, count, opts, print_Metar, (void *)ctx);
+
+  if (pthread_create(&decoder, NULL, decode_stage, &pipe) == 0) {
+    if (pthread_create(&printer, NULL, output_stage, &pipe) == 0) {
+      started = 1;
+    } else {
+      ring_close(&pipe.decodeq);
+      pthread_join(decoder, NULL);
     }
   }
-  printf("\n");
+
+  if (started) {
+    res = fetch_Metars(fetches, count, opts, queue_Metar, &pipe);
+    ring_close(&pipe.decodeq);
+    pthread_join(decoder, NULL);
+    pthread_join(printer, NULL);
+
+    ring_stats(&pipe.decodeq, &qs);
+    stats_queue(STAT_QDECODE, &qs);
+    ring_stats(&pipe.outputq, &qs);
+    stats_queue(STAT_QOUTPUT, &qs);
+  } else {
+    res = fetch_Metars(fetches, count, opts, print_Metar, (void *)ctx);
+  }
+  ring_free(&pipe.decodeq);
+  ring_free(&pipe.outputq);
+  return res;
+}
+
+
+/* time range of a history query */
+typedef struct {
+  time_t from;
+  time_t to;
+} query_range_t;
+
+
+/* print out a record of the history within the range */
+void print_stored(const metar_rec_t *rec, void *arg) {
+  const query_range_t *range = arg;
+  metar_t metar;
+  time_t obstime = rec->obstime;
+  struct tm tm;
+  char date[32];
+
+  if (obstime < range->from || obstime > range->to) return;
+  metar_unpack(rec, &metar);
+  gmtime_r(&obstime, &tm);
+  if (decode|shortdecode) {
+    strftime(date, sizeof(date), "%Y/%m/%d %H:%M\n", &tm);
+    outbuf_puts(&ob, date);
+  }
+  if (decode) {
+    decode_Metar(&ob, &metar);
+  }
+  if (shortdecode) {
+    shortdecode_Metar(&ob, &metar, extra);
+  }
+  if (format) {
+    print_formatted(&ob, &metar, nformatted++ == 0);
+  }
+}
+
+
+/* print out the stored reports of the stations, or all of them */
+int query_history(const char *path, char **stations, int count,
+		  time_t from, time_t to) {
+  query_range_t range = { from, to };
+  history_t h;
+  int i;
+
+  if (history_open(&h, path)) return 1;
+  if (count == 0) {
+    history_scan(&h, print_stored, &range);
+  } else {
+    for (i = 0; i < count; i++)
+      history_query(&h, strupc(stations[i]), from, to, print_stored, &range);
+  }
+  history_close(&h);
+  return finish_output();
 }
 
 
 int main(int argc, char* argv[]) {
   int i=0;
   int res=0;
-  metar_t metar;
-  noaa_t  noaa;
+  int count, bad=0;
+  char **stations;
+  const char *url;
+  area_t area;
+  fetch_t *fetches;
+  fetch_opts_t opts;
+  daemon_opts_t dopts;
+  metar_ctx_t ctx;
+  time_t from=0, to=UINT32_MAX;
 
   /* get options */
   opterr=0;
+  fetch_opts_init(&opts);
+  memset(&dopts, 0x0, sizeof(dopts));
+  memset(&area, 0x0, sizeof(area));
+  dopts.socket = DAEMON_SOCKET;
+  dopts.interval = DAEMON_INTERVAL;
+  dopts.adaptive = 1;
   if (argc == 1) {
     usage(argv[0]);
     return 1;
   }
 
-  while ((res = getopt(argc, argv, "?hvbdern")) != -1) {
+  while ((res = getopt_long(argc, argv, "?hvbc:defrnj:o:t:u:J:", longopts, NULL))
+	 != -1) {
     switch (res) {
     case '?':
       usage(argv[0]);
@@ -271,6 +730,9 @@ int main(int argc, char* argv[]) {
     case 'b':
       shortdecode=1;
       break;
+    case 'c':
+      opts.cachedir=optarg;
+      break;
     case 'd':
       decode=1;
       break;
@@ -278,67 +740,238 @@ int main(int argc, char* argv[]) {
       shortdecode=1;
       extra=1;
       break;
+    case 'f':
+      files=1;
+      break;
+    case 'j':
+      opts.maxconn=atoi(optarg);
+      break;
+    case 'J':
+      nthreads=atoi(optarg);
+      if (nthreads < 1) {
+	fprintf(stderr, "Invalid number of threads %s.\n", optarg);
+	return 1;
+      }
+      break;
     case 'n':
       noconvert=1;
       break;
+    case 'o':
+      if (strcmp(optarg, "json") == 0) format=OUTPUT_JSON;
+      else if (strcmp(optarg, "ndjson") == 0) format=OUTPUT_NDJSON;
+      else if (strcmp(optarg, "csv") == 0) format=OUTPUT_CSV;
+      else {
+	fprintf(stderr, "Unknown output format %s.\n", optarg);
+	return 1;
+      }
+      break;
     case 'r':
       rawmetar=1;
       break;
+    case 't':
+      opts.cachettl=atoi(optarg);
+      break;
+    case 'u':
+      if (opts.nurls == FETCH_MAXMIRRORS) {
+	fprintf(stderr, "At most %d mirrors can be given.\n",
+		FETCH_MAXMIRRORS);
+	return 1;
+      }
+      opts.urls[opts.nurls++]=optarg;
+      break;
     case 'v':
       verbose=1;
       break;
+    case OPT_DAEMON:
+      daemonize=1;
+      break;
+    case OPT_SOCKET:
+      dopts.socket=optarg;
+      break;
+    case OPT_INTERVAL:
+      dopts.interval=atoi(optarg);
+      if (dopts.interval < 1) {
+	fprintf(stderr, "Invalid interval %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_POLL:
+      if (strcmp(optarg, "fixed") == 0) {
+	dopts.adaptive=0;
+      } else if (strcmp(optarg, "adaptive") == 0) {
+	dopts.adaptive=1;
+      } else {
+	fprintf(stderr, "Unknown polling %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_HISTORY:
+      histfile=optarg;
+      break;
+    case OPT_QUERY:
+      queryfile=optarg;
+      break;
+    case OPT_FROM:
+    case OPT_TO:
+      if (parse_time(optarg) < 0) {
+	fprintf(stderr, "Invalid time %s.\n", optarg);
+	return 1;
+      }
+      if (res == OPT_FROM) from=parse_time(optarg);
+      else to=parse_time(optarg);
+      break;
+    case OPT_CONNECT_TIMEOUT:
+      if (parse_secs(optarg, &opts.connecttimeout)) {
+	fprintf(stderr, "Invalid timeout %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_TIMEOUT:
+      if (parse_secs(optarg, &opts.timeout)) {
+	fprintf(stderr, "Invalid timeout %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_HEDGE:
+      if (strcmp(optarg, "auto") == 0) {
+	opts.hedge=FETCH_HEDGE_AUTO;
+      } else if (parse_secs(optarg, &opts.hedge)) {
+	fprintf(stderr, "Invalid hedge delay %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_CYCLES:
+      opts.cycles=atoi(optarg);
+      if (opts.cycles < 0) {
+	fprintf(stderr, "Invalid number of stations %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_QUEUE:
+      queuesize=atoi(optarg);
+      if (queuesize < 0) {
+	fprintf(stderr, "Invalid queue size %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_STATS:
+      showstats=1;
+      break;
+    case OPT_FIELDS:
+      if (metar_fields(optarg, &fields)) {
+	fprintf(stderr, "Unknown field in %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_NEAR:
+      if (parse_near(optarg, &area)) {
+	fprintf(stderr, "Invalid position %s.\n", optarg);
+	return 1;
+      }
+      break;
+    case OPT_BBOX:
+      if (parse_bbox(optarg, &area)) {
+	fprintf(stderr, "Invalid box %s.\n", optarg);
+	return 1;
+      }
+      break;
     }
   }
 
+  if (nthreads == 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
   /* if we aren't given any output options, default to shortdecode */
-  if ( !decode && !rawmetar && !shortdecode ) shortdecode = 1;
+  if ( !decode && !rawmetar && !shortdecode && !format ) shortdecode = 1;
 
-  curl_global_init(CURL_GLOBAL_DEFAULT);
+  outbuf_init(&ob, stdout);
 
-  // clear out metar and noaa
-  memset(&metar, 0x0, sizeof(metar_t));
-  memset(&noaa, 0x0, sizeof(noaa_t));
+  metar_ctx_init(&ctx);
+  ctx.noconvert = noconvert;
+  ctx.verbose = verbose;
+  ctx.fields = fields;
+  opts.verbose = verbose;
 
+  /* the daemon always keeps statistics, for queries */
+  if (showstats || daemonize) stats_init();
+
+  /* the history keeps whole reports */
+  if (histfile && fields != METAR_F_ALL) {
+    fprintf(stderr, "--fields can't be used with --history.\n");
+    return 1;
+  }
+
+  /* add the stations asked for by position */
+  stations = argv + optind;
+  count = argc - optind;
+  if ((area.nearest || area.bbox) && !files) {
+    stations = area_stations(&area, stations, count, &count);
+    if (stations == NULL) {
+      fprintf(stderr, "Out of memory for the stations of the area.\n");
+      return 1;
+    }
+  }
+
+  /* print out the stored reports */
+  if (queryfile) {
+    return query_history(queryfile, stations, count, from, to);
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
 
   /* we need at least one parameter if options are given */
-  if (optind == argc) {
-    usage(argv[0]);
+  if (count == 0) {
+    if (!area.bbox) usage(argv[0]);
     return 1;
   }
 
-  /* now get metar data from each parameter */
-  for (i = optind; i < argc; i++) {
-
-    /* if successfully downloaded... */
-    if (download_Metar(argv[i]) == 0) {
-
-      /* ...and parsed NOAA data, parse each METAR report if needed and
-	 print stuff out */
-      if (parse_NOAA_data(noaabuffer, &noaa) == 0) {
-	if (rawmetar) printf("%s", noaa.report);
-	if (decode|shortdecode) {
-	  parse_Metar(noaa.report, &metar);
-	}
-	if (decode) {
-	  decode_Metar(metar);
-	}
-	if (shortdecode) {
-	  shortdecode_Metar(metar);
-	}
-      } else {
-	/* parse_NOAA_data() returns 1 when station isn't found */
-	printf("METAR station %s not found in NOAA data.\n",
-		argv[i]);
-      }
+  if (histfile && (history = history_create(histfile)) == NULL) return 1;
+
+  /* decode the reports in each file given */
+  if (files) {
+    res = 0;
+    for (i = optind; i < argc; i++)
+      if (bulk_Metars_parallel(argv[i], verbose ? 1 : nthreads,
+			       decode_record, merge_records, &ctx)) res = 1;
+    if (finish_output()) res = 1;
+    if (history && fclose(history)) res = 1;
+    return res;
+  }
 
-    } else {
-      /* download_Metar() returns 1 and prints the error code of CURL
-	 if something has gone wrong */
-      printf("METAR data download failed.\n");
+  count = check_stations(stations, count, &bad);
+  if (count == 0) return 1;
+
+  /* keep the stations fresh and answer queries until stopped */
+  if (daemonize) {
+    url = opts.nurls ? opts.urls[0] : getenv("METARURL");
+    if (url && fetch_transport(url) == fetch_transport("-")) {
+      fprintf(stderr, "--daemon can't refresh from standard input.\n");
+      return 1;
     }
+    dopts.extra = extra;
+    dopts.fetch = &opts;
+    dopts.ctx = &ctx;
+    return run_daemon(&dopts, stations, count);
+  }
 
+  /* now get metar data from each parameter */
+  fetches = calloc(count, sizeof(fetch_t));
+  for (i = 0; i < count; i++)
+    strncpy(fetches[i].station, stations[i],
+	    sizeof(fetches[i].station) - 1);
+
+  /* the parser's messages keep to the order of the output on one thread */
+  if (queuesize && !verbose) res = pipeline_Metars(fetches, count, &opts,
+						   &ctx);
+  else res = fetch_Metars(fetches, count, &opts, print_Metar, &ctx);
+  if (res) {
+    fprintf(stderr, "Unable to set up transfers.\n");
+    return 1;
   }
-  return 0;
+  free(fetches);
+  if (finish_output()) return 1;
+  if (history && fclose(history)) return 1;
+
+  return bad;
 }
 
 // EOF
@@ -21,18 +21,24 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <sys/types.h>
-#include <regex.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include "metar.h"
+#include "tokenize.h"
 
-extern int noconvert;
-extern int verbose;
-extern int shortdecode;
-extern int extra;
-extern int decode;
+/* visibility reported as 9999 m means more than 10 km */
+#define VIS_THRESHOLD 9999
+
+/* options of parse_Metar() */
+int metar_verbose = 0;
+int metar_noconvert = 0;
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define IS_UPPER(c) ((c) >= 'A' && (c) <= 'Z')
 
 struct observation {
   const char *code;
@@ -41,7 +47,7 @@ struct observation {
 
 typedef struct observation observation_t;
 
-struct observation observations[] = {
+static struct observation observations[] = {
   /* according to WMO-306 code table 4678 */
   /* proximity */
   {"VC", "vicinity "},
@@ -84,357 +90,352 @@ struct observation observations[] = {
 };
 
 
-/* Add a cloud to a list of clouds */
-static void add_cloud(cloudlist_t **head, cloud_t *cloud) {
-  cloudlist_t *current;
+/* 2-letter phenomena codes mapped to 1 + their index in observations[],
+ * 0 for anything else */
+static const unsigned char obs_lut[26][26] = {
+  ['V'-'A']['C'-'A'] = 1, ['M'-'A']['I'-'A'] = 2, ['B'-'A']['C'-'A'] = 3,
+  ['P'-'A']['R'-'A'] = 4, ['D'-'A']['R'-'A'] = 5, ['B'-'A']['L'-'A'] = 6,
+  ['S'-'A']['H'-'A'] = 7, ['T'-'A']['S'-'A'] = 8, ['F'-'A']['Z'-'A'] = 9,
+  ['D'-'A']['Z'-'A'] = 10, ['R'-'A']['A'-'A'] = 11, ['S'-'A']['N'-'A'] = 12,
+  ['S'-'A']['G'-'A'] = 13, ['I'-'A']['C'-'A'] = 14, ['P'-'A']['L'-'A'] = 15,
+  ['G'-'A']['R'-'A'] = 16, ['G'-'A']['S'-'A'] = 17, ['U'-'A']['P'-'A'] = 18,
+  ['B'-'A']['R'-'A'] = 19, ['F'-'A']['G'-'A'] = 20, ['F'-'A']['U'-'A'] = 21,
+  ['V'-'A']['A'-'A'] = 22, ['D'-'A']['U'-'A'] = 23, ['S'-'A']['A'-'A'] = 24,
+  ['H'-'A']['Z'-'A'] = 25, ['P'-'A']['Y'-'A'] = 26, ['P'-'A']['O'-'A'] = 27,
+  ['S'-'A']['Q'-'A'] = 28, ['F'-'A']['C'-'A'] = 29, ['S'-'A']['S'-'A'] = 30,
+  ['D'-'A']['S'-'A'] = 31, ['R'-'A']['E'-'A'] = 32
+};
 
-  if (*head == NULL) {
-    *head = malloc(sizeof(cloudlist_t));
-    current = *head;
-    current->cloud = cloud;
-    current->next = NULL;
-    return;
-  }
-  current = *head;
-  while (current->next != NULL)
-    current = current->next;
-
-  current->next = (cloudlist_t *)malloc(sizeof(cloudlist_t));
-  current = current->next;
-  current->cloud = cloud;
-  current->next = NULL;
-} // add_cloud
 
+/* Add a cloud layer, returns 0 if there is no room left */
+static int add_cloud(metar_t *metar, const cloud_t *cloud) {
+  if (metar->nclouds == METAR_MAXCLOUDS) return 0;
+  metar->clouds[metar->nclouds++] = *cloud;
+  return 1;
+} // add_cloud
 
-/* Add observation */
-static void add_observation(obslist_t **head, char *obs) {
-  obslist_t *current;
 
-  if (*head == NULL) {
-    *head = malloc(sizeof(obslist_t));
-    current = *head;
-    current->obs = obs;
-    current->next = NULL;
-    return;
-  }
-  current = *head;
-  while (current->next != NULL)
-    current = current->next;
-
-  current->next = (obslist_t *)malloc(sizeof(obslist_t));
-  current = current->next;
-  current->obs = obs;
-  current->next = NULL;
+/* Add observation, returns 0 if there is no room left */
+static int add_observation(metar_t *metar, const metar_obs_t *obs) {
+  if (metar->nobs == METAR_MAXOBS) return 0;
+  metar->obs[metar->nobs++] = *obs;
+  return 1;
 } // add_observation
 
-/* Add observation */
-static void add_stuff(stufflist_t **head, char *stuff) {
-  stufflist_t *current;
 
-  if (*head == NULL) {
-    *head = malloc(sizeof(stufflist_t));
-    current = *head;
-    current->stuff = stuff;
-    current->next = NULL;
-    return;
+/* Add other stuff, returns 0 if there is no room left */
+static int add_stuff(metar_t *metar, const char *stuff) {
+  if (metar->nstuff == METAR_MAXSTUFF) return 0;
+  metar->stuff[metar->nstuff++] = stuff;
+  return 1;
+} // add_stuff
+
+
+/* get the index of the 2-letter code at p in observations[], -1 if the code
+ * is unknown */
+static int decode_obs(const char *p) {
+  if (!IS_UPPER(p[0]) || !IS_UPPER(p[1])) return -1;
+  return obs_lut[p[0] - 'A'][p[1] - 'A'] - 1;
+}
+
+
+/*
+ * Group matchers. Each one walks the token once, checks it against the
+ * format of one group type and, on success, fills the corresponding fields
+ * of the metar struct directly. They replace the regular expressions which
+ * used to be compiled (and never freed) for every token.
+ */
+
+/* number of leading digits in s, at most n */
+static int count_digits(const char *s, int n) {
+  int i;
+  for (i = 0; i < n && IS_DIGIT(s[i]); i++);
+  return i;
+}
+
+/* value of n decimal digits starting at s, INT_MAX if it's larger */
+static int get_number(const char *s, int n) {
+  int v = 0;
+  while (n-- > 0)
+    v = (v > (INT_MAX - 9) / 10) ? INT_MAX : v * 10 + (*s++ - '0');
+  return v;
+}
+
+
+/* station: ^[A-Z]+$ */
+static int match_station(const char *t, int len, metar_t *metar) {
+  int i;
+
+  if (len == 0) return 0;
+  for (i = 0; i < len; i++)
+    if (!IS_UPPER(t[i])) return 0;
+
+  if (len > (int)sizeof(metar->station) - 1)
+    len = sizeof(metar->station) - 1;
+  memcpy(metar->station, t, len);
+  return 1;
+}
+
+
+/* day/time: ^[0-9]{2}[0-9]{4}Z$ */
+static int match_daytime(const char *t, int len, metar_t *metar) {
+  if (len != 7 || t[6] != 'Z' || count_digits(t, 6) != 6) return 0;
+
+  metar->day = get_number(t, 2);
+  metar->time = get_number(t+2, 4);
+  return 1;
+}
+
+
+/* wind: ^(VRB|[0-9]{3})([0-9]{2})(G[0-9]+)?(KT|MPS)$ */
+static int match_wind(const char *t, int len, metar_t *metar) {
+  int unitlen, glen = 0;
+
+  if (len < 7) return 0;
+  if (t[len-2] == 'K' && t[len-1] == 'T') unitlen = 2;
+  else if (len >= 8 && t[len-3] == 'M' && t[len-2] == 'P' && t[len-1] == 'S')
+    unitlen = 3;
+  else return 0;
+
+  if (!(t[0] == 'V' && t[1] == 'R' && t[2] == 'B') && count_digits(t, 3) != 3)
+    return 0;
+  if (count_digits(t+3, 2) != 2) return 0;
+
+  if (len - unitlen > 5) {
+    if (t[5] != 'G') return 0;
+    glen = len - unitlen - 6;
+    if (glen == 0 || count_digits(t+6, glen) != glen) return 0;
   }
-  current = *head;
-  while (current->next != NULL)
-    current = current->next;
-
-  current->next = (stufflist_t *)malloc(sizeof(stufflist_t));
-  current = current->next;
-  current->stuff = stuff;
-  current->next = NULL;
-} // add_observation
 
+  metar->winddir = (t[0] == 'V') ? -1 : get_number(t, 3);
+  metar->windstr = get_number(t+3, 2);
+  metar->windgust = glen ? get_number(t+6, glen) : metar->windstr;
+  memcpy(metar->windunit, t+len-unitlen, unitlen);
+  return 1;
+}
+
+
+/* visibility: ^([0-9]{1,5})(SM)?$ */
+static int match_visibility(const char *t, int len, metar_t *metar) {
+  int n = count_digits(t, len);
+
+  if (n == 0 || n > 5) return 0;
+  if (n == len) {
+    strcpy(metar->visunit, "m");
+  } else if (n + 2 == len && t[n] == 'S' && t[n+1] == 'M') {
+    memcpy(metar->visunit, "SM", 2);
+  } else return 0;
+
+  metar->vis = get_number(t, n);
+  return 1;
+}
 
-/* build the observations regexp patters*/
-static void get_observations_pattern(char *pattern, int len) {
-  int i=0, p=0;
-  int size = sizeof(observations) / sizeof(observation_t);
 
-  for (i=0; i < size; i++) {
-    // add observation to string if we have enough space left
-    p = strlen(pattern);
-    if (p + strlen(observations[i].code) < len)
-      strcpy(&pattern[p], observations[i].code);
+/* temperature and dewpoint: ^(M?)([0-9]+)/(M?)([0-9]+)$ */
+static int match_temp(const char *t, int len, metar_t *metar) {
+  const char *p = t, *end = t + len, *temp, *dewp;
+  int tneg, dneg, tlen, dlen;
 
-    // add separator
-    p = strlen(pattern);
-    if (p < len) pattern[p++] = '|';
+  if ((tneg = (p < end && *p == 'M'))) p++;
+  temp = p;
+  tlen = count_digits(p, end - p);
+  if (tlen == 0 || p + tlen == end || p[tlen] != '/') return 0;
+  p += tlen + 1;
+
+  if ((dneg = (p < end && *p == 'M'))) p++;
+  dewp = p;
+  dlen = count_digits(p, end - p);
+  if (dlen == 0 || p + dlen != end) return 0;
+
+  metar->temp = tneg ? -get_number(temp, tlen) : get_number(temp, tlen);
+  metar->dewp = dneg ? -get_number(dewp, dlen) : get_number(dewp, dlen);
+  return 1;
+}
+
+
+/* qnh: ^([QA])([0-9]{1,4})$ */
+static int match_qnh(const char *t, int len, metar_t *metar) {
+  if (len < 2 || len > 5 || (t[0] != 'Q' && t[0] != 'A')) return 0;
+  if (count_digits(t+1, len-1) != len-1) return 0;
+
+  if (t[0] == 'Q')
+    strcpy(metar->qnhunit, "hPa");
+  else {
+    strcpy(metar->qnhunit, "inHg");
+    metar->qnhfp = 2;
   }
+  metar->qnh = get_number(t+1, len-1);
+  return 1;
+}
+
+
+/* cloud layer: ^(VV|SKC|FEW|SCT|BKN|OVC)([0-9]{3})$ */
+static int match_cloud(const char *t, int len, cloud_t *cloud) {
+  static const char *types[] = { "SKC", "FEW", "SCT", "BKN", "OVC" };
+  int i, ntypes = sizeof(types) / sizeof(types[0]), typelen = len - 3;
 
-  // remove last |
-  pattern[strlen(pattern)-1] = 0;
+  if (typelen < 2 || typelen > 3 || count_digits(t+typelen, 3) != 3)
+    return 0;
+  if (typelen == 2) {
+    if (t[0] != 'V' || t[1] != 'V') return 0;
+  } else {
+    for (i = 0; i < ntypes; i++)
+      if (memcmp(t, types[i], 3) == 0) break;
+    if (i == ntypes) return 0;
+  }
+
+  memset(cloud, 0x0, sizeof(cloud_t));
+  memcpy(&cloud->type, t, typelen);
+  cloud->level = get_number(t+typelen, 3);
+  return 1;
 }
 
 
-/* get the description of code pattern */
-static char *decode_obs(char *pattern) {
-  int i=0;
-  int size = sizeof(observations) / sizeof(observation_t);
+/* phenomena: ^([+-]?)((VC|MI|...|RE)+)$, kept as a list of codes */
+static int match_phenomena(const char *t, int len, metar_obs_t *obs) {
+  const char *p = t, *end = t + len;
+  int code;
+
+  memset(obs, 0x0, sizeof(metar_obs_t));
+  if (p < end && (*p == '-' || *p == '+'))
+    obs->intensity = (*p++ == '-') ? -1 : 1;
+  if (p == end || (end - p) % 2) return 0;
+
+  for (; p < end; p += 2) {
+    if ((code = decode_obs(p)) < 0) return 0;
+    if (obs->ncodes < METAR_MAXCODES) obs->codes[obs->ncodes++] = code;
+  }
+  return 1;
+}
+
 
-  for (i=0; i < size; i++)
-    if (strncmp(pattern, observations[i].code, 2) == 0)
-      return (char*) observations[i].description;
+/* does the token contain the given word */
+static int contains(const char *t, int len, const char *word) {
+  int i, n = strlen(word);
 
-  return NULL;
+  for (i = 0; i + n <= len; i++)
+    if (memcmp(t+i, word, n) == 0) return 1;
+  return 0;
 }
 
 
 /* Analyse the token which is provided and, when possible, set the
- * corresponding value in the metar struct
+ * corresponding value in the metar struct. Matchers whose class hint
+ * (see tokenize.h) isn't set can't match and are skipped, as are the
+ * ones of fields which aren't wanted; the groups of the fields don't
+ * overlap, so that doesn't change how the other tokens are read.
  */
-static void analyse_token(char *token, metar_t *metar) {
-  regex_t preg;
-  regmatch_t pmatch[5];
-  int size;
-  char tmp[99];
-  char obspattern[255];
-  char obsp[275];
-  static int vis_thresold = 9999;
-
-  extern char wind_convfrom[5];
-  extern char wind_convto[5];
-  extern float wind_convfac;
+static void analyse_token(const metar_ctx_t *ctx, const char *token, int len,
+			  unsigned int hints, metar_t *metar) {
+  unsigned int fields = ctx->fields;
+  int verbose = ctx->verbose;
+  cloud_t cloud;
+  metar_obs_t obs;
+  char text[METAR_OBSSIZE];
 
-  if (verbose) printf("Parsing token `%s'\n", token);
+  if (verbose) printf("Parsing token `%.*s'\n", len, token);
 
   // find station
-  if (metar->station[0] == 0) {
-    if (regcomp(&preg, "^([A-Z]+)$", REG_EXTENDED)) {
-      perror("parseMetar");
-      exit(errno);
-    }
-    if (!regexec(&preg, token, 5, pmatch, 0)) {
-      size = pmatch[1].rm_eo - pmatch[1].rm_so;
-      memcpy(metar->station, token+pmatch[1].rm_so,
-	     (size < 10 ? size : 10));
-      if (verbose) printf("   Found station %s\n", metar->station);
-      return;
-    }
+  if (metar->station[0] == 0 && (hints & TOKEN_UPPER) &&
+      match_station(token, len, metar)) {
+    metar->found |= METAR_F_STATION;
+    if (verbose) printf("   Found station %s\n", metar->station);
+    return;
   }
 
   // find day/time
-  if ((int)metar->day == 0) {
-    if (regcomp(&preg, "^([0-9]{2})([0-9]{4})Z$", REG_EXTENDED)) {
-      perror("parseMetar");
-      exit(errno);
-    }
-    if (!regexec(&preg, token, 5, pmatch, 0)) {
-      size = pmatch[1].rm_eo - pmatch[1].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[1].rm_so, (size < 99 ? size : 99));
-      sscanf(tmp, "%d", (int*)&metar->day);
-
-      size = pmatch[2].rm_eo - pmatch[2].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[2].rm_so, (size < 99 ? size : 99));
-      sscanf(tmp, "%d", (int*)&metar->time);
-      if (verbose) printf("   Found Day/Time %d/%d\n",
-			  metar->day, metar->time);
-
-      return;
-    }
+  if ((fields & METAR_F_TIME) && (int)metar->day == 0 &&
+      (hints & TOKEN_Z) &&
+      match_daytime(token, len, metar)) {
+    metar->found |= METAR_F_TIME;
+    if (verbose) printf("   Found Day/Time %d/%d\n",
+			metar->day, metar->time);
+    return;
   } // daytime
 
   // find wind
-  if ((int)metar->winddir == 0) {
-    if (regcomp(&preg, "^(VRB|[0-9]{3})([0-9]{2})(G[0-9]+)?(KT|MPS)$",
-		REG_EXTENDED)) {
-      perror("parseMetar");
-      exit(errno);
-    }
-    if (!regexec(&preg, token, 5, pmatch, 0)) {
-      size = pmatch[1].rm_eo - pmatch[1].rm_so;
-      memset(tmp, 0x0, 99);
-      if (size) {
-	memcpy(tmp, token+pmatch[1].rm_so, (size < 99 ? size : 99));
-	if (strstr(tmp, "VRB") == NULL) { // winddir
-	  sscanf(tmp, "%d", (int*)&metar->winddir);
-	} else { // vrb
-	  metar->winddir = -1;
-	}
-      }
-
-      size = pmatch[2].rm_eo - pmatch[2].rm_so;
-      memset(tmp, 0x0, 99);
-      if (size) {
-	memcpy(tmp, token+pmatch[2].rm_so, (size < 99 ? size : 99));
-	sscanf(tmp, "%f", (float*)&metar->windstr);
-      }
-
-      size = pmatch[3].rm_eo - pmatch[3].rm_so;
-      memset(tmp, 0x0, 99);
-      if (size) {
-	memcpy(tmp, token+pmatch[3].rm_so+1, (size < 99 ? size-1 : 99));
-	sscanf(tmp, "%f", (float*)&metar->windgust);
-      } else {
-	metar->windgust = metar->windstr;
-      }
-
-      size = pmatch[4].rm_eo - pmatch[4].rm_so;
-      if (size) {
-	memcpy(&metar->windunit, token+pmatch[4].rm_so, (size < 5 ? size : 5));
-      }
-
-      /* stuff for converting wind from wind_convfrom to wind_convto */
-      /* if noconvert is not specified AND wind unit is knots, do conversion */
-      if ( (!noconvert) && (strcmp(metar->windunit, wind_convfrom) == 0) ) {
-
-	/* although these are pointers, their type is float and we can
+  if ((fields & METAR_F_WIND) && (int)metar->winddir == 0 &&
+      (hints & TOKEN_WIND) &&
+      match_wind(token, len, metar)) {
+    metar->found |= METAR_F_WIND;
+    /* stuff for converting wind from wind_convfrom to wind_convto */
+    /* if noconvert is not specified AND wind unit is knots, do conversion */
+    if ( (!ctx->noconvert) &&
+	 (strcmp(metar->windunit, ctx->wind_convfrom) == 0) ) {
+
+      /* although these are pointers, their type is float and we can
 	 multiply them with another float */
-	metar->windstr = (metar->windstr) * wind_convfac;
-	metar->windgust = (metar->windgust) * wind_convfac;
-	/* let's hope we didn't mess anything up.. */
-	strcpy(metar->windunit, wind_convto);
-      }
-
-      if (verbose) printf("   Found Winddir/str/gust/unit %d/%f/%f/%s\n",
-			  metar->winddir, metar->windstr, metar->windgust,
-			  metar->windunit);
-      return;
+      metar->windstr = (metar->windstr) * ctx->wind_convfac;
+      metar->windgust = (metar->windgust) * ctx->wind_convfac;
+      /* let's hope we didn't mess anything up.. */
+      strcpy(metar->windunit, ctx->wind_convto);
     }
+
+    if (verbose) printf("   Found Winddir/str/gust/unit %d/%f/%f/%s\n",
+			metar->winddir, metar->windstr, metar->windgust,
+			metar->windunit);
+    return;
   } // wind
 
   // find visibility
-  if ((int)metar->vis == 0) {
-    if (regcomp(&preg, "^([0-9]+)(SM)?$", REG_EXTENDED)) {
-      perror("parsemetar");
-      exit(errno);
-    }
-    if (!regexec(&preg, token, 5, pmatch, 0)) {
-      size = pmatch[1].rm_eo - pmatch[1].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[1].rm_so, (size < 99 ? size : 99));
-      sscanf(tmp, "%d", (int*)&metar->vis);
-
-      size = pmatch[2].rm_eo - pmatch[2].rm_so;
-      if (size) {
-	memset(tmp, 0x0, 99);
-	memcpy(&metar->visunit, token+pmatch[2].rm_so,
-	       (size < 5 ? size : 5));
-      } else
-	strncpy(metar->visunit, "m", 1);
-
-      /* return -1 as visibility range if it's 9999 M (>10km) */
-      /* it's easier to do it this way because we are fiddling with this
+  if ((fields & METAR_F_VIS) && (int)metar->vis == 0 &&
+      (hints & TOKEN_DIGIT1) &&
+      match_visibility(token, len, metar)) {
+    metar->found |= METAR_F_VIS;
+    /* return -1 as visibility range if it's 9999 M (>10km) */
+    /* it's easier to do it this way because we are fiddling with this
        again at CAVOK and it's easier to check it upon printing from main.c */
-      if (metar->vis == vis_thresold) {
-	metar->vis = -1;
-	if (verbose) printf("   Visibility over 10 km\n");
-      }	else if (verbose) {
-	printf("   Visibility range/unit %d/%s\n", metar->vis, metar->visunit);
-      }
-      return;
+    if (metar->vis == VIS_THRESHOLD) {
+      metar->vis = -1;
+      if (verbose) printf("   Visibility over 10 km\n");
+    } else if (verbose) {
+      printf("   Visibility range/unit %d/%s\n", metar->vis, metar->visunit);
     }
+    return;
   } // visibility
 
   // find temperature and dewpoint
-  if ((int)metar->temp == 0) {
-    if (regcomp(&preg, "^(M?)([0-9]+)/(M?)([0-9]+)$", REG_EXTENDED)) {
-      perror("parsemetar");
-      exit(errno);
-    }
-    if (!regexec(&preg, token, 5, pmatch, 0)) {
-      size = pmatch[2].rm_eo - pmatch[2].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[2].rm_so, (size < 99 ? size : 99));
-      sscanf(tmp, "%d", &metar->temp);
-
-      size = pmatch[1].rm_eo - pmatch[1].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[1].rm_so, (size < 99 ? size : 99));
-      if (strncmp(tmp, "M", 1) == 0) metar->temp = -metar->temp;
-
-      size = pmatch[4].rm_eo - pmatch[4].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[4].rm_so, (size < 99 ? size : 99));
-      sscanf(tmp, "%d", &metar->dewp);
-
-      size = pmatch[3].rm_eo - pmatch[3].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[3].rm_so, (size < 99 ? size : 99));
-      if (strncmp(tmp, "M", 1) == 0) metar->dewp = -metar->dewp;
-
-      if (verbose)
-	printf("   Temp/dewpoint %d/%d\n", metar->temp, metar->dewp);
-      return;
-    }
+  if ((fields & METAR_F_TEMP) && (int)metar->temp == 0 &&
+      (hints & TOKEN_SLASH) &&
+      match_temp(token, len, metar)) {
+    metar->found |= METAR_F_TEMP;
+    if (verbose)
+      printf("   Temp/dewpoint %d/%d\n", metar->temp, metar->dewp);
+    return;
   } // temp
 
   // find qnh
-  if ((int)metar->qnh == 0) {
-    if (regcomp(&preg, "^([QA])([0-9]+)$", REG_EXTENDED)) {
-      perror("parsemetar");
-      exit(errno);
-    }
-    if (!regexec(&preg, token, 5, pmatch, 0)) {
-      size = pmatch[1].rm_eo - pmatch[1].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[1].rm_so, (size < 5 ? size : 5));
-      if (strncmp(tmp, "Q", 1) == 0)
-	strncpy(metar->qnhunit, "hPa", 3);
-      else if (strncmp(tmp, "A", 1) == 0) {
-	strncpy(metar->qnhunit, "inHg", 4);
-	metar->qnhfp = 2;
-      }
-      else
-	strncpy(metar->qnhunit, "Unkn", 4);
-
-      size = pmatch[2].rm_eo - pmatch[2].rm_so;
-      memset(tmp, 0x0, 99);
-      memcpy(tmp, token+pmatch[2].rm_so, (size < 99 ? size : 99));
-      sscanf(tmp, "%d", &metar->qnh);
-
-      if (verbose)
-	printf("   Pressure/unit %d/%s\n", metar->qnh, metar->qnhunit);
-
-      return;
-    }
+  if ((fields & METAR_F_QNH) && (int)metar->qnh == 0 &&
+      (hints & TOKEN_QA) &&
+      match_qnh(token, len, metar)) {
+    metar->found |= METAR_F_QNH;
+    if (verbose)
+      printf("   Pressure/unit %d/%s\n", metar->qnh, metar->qnhunit);
+    return;
   } // qnh
 
   // multiple cloud layers possible
-  if (regcomp(&preg, "^(VV|SKC|FEW|SCT|BKN|OVC)([0-9]{3})$", REG_EXTENDED)) {
-    perror("parsemetar");
-    exit(errno);
-  }
-  if (!regexec(&preg, token, 5, pmatch, 0)) {
-    cloud_t *cloud = malloc(sizeof(cloud_t));
-    memset(cloud, 0x0, sizeof(cloud_t));
-
-    size=pmatch[1].rm_eo - pmatch[1].rm_so;
-    memcpy(&cloud->type, token+pmatch[1].rm_so, (size < 3 ? size : 3));
-
-    size=pmatch[2].rm_eo - pmatch[2].rm_so;
-    memset(tmp, 0x0, 99);
-    memcpy(tmp, token+pmatch[2].rm_so, (size < 3 ? size : 3));
-    sscanf(tmp, "%d", (int*)&cloud->level);
-
-    add_cloud((cloudlist_t **)&metar->clouds, cloud);
-    if (verbose)
-      printf("   Cloud cover/alt %s/%d00\n", cloud->type, cloud->level);
+  if ((fields & METAR_F_CLOUDS) && (len == 5 || len == 6) &&
+      match_cloud(token, len, &cloud)) {
+    if (!add_cloud(metar, &cloud)) {
+      if (verbose) printf("   Too many cloud layers\n");
+    } else if (verbose)
+      printf("   Cloud cover/alt %s/%d00\n", cloud.type, cloud.level);
     return;
   } // cloud
 
-  // phenomena
-  memset(obsp, 0x0, 275);
-  memset(obspattern, 0x0, 255);
-  get_observations_pattern(obspattern, 255);
-  snprintf(obsp, 255, "^([+-]?)((%s)+)$", obspattern);
-
-
   /* these observations are parsed separately since an algorithm to do
      it would be nasty. these are not exactly weather stuff so i made
      them own struct and that way it's easy to omit these from reports */
   /* it should be easy to add stuff observations afterwards anyway */
   // cannot to CAVOK as an observation in the array because it is more than
   // 2 characters long and that screw up my algorithm
-  if (strstr(token, "CAVOK") != NULL) {
-    add_stuff((stufflist_t **)&metar->stuff, "ceiling and visibility OK");
+  if ((fields & (METAR_F_OTHER | METAR_F_VIS)) && len >= 5 &&
+      contains(token, len, "CAVOK")) {
+    if (fields & METAR_F_OTHER) add_stuff(metar, METAR_CAVOK);
     /* yeah, CAVOK means visibility is > 10 km so hit it */
     metar->vis = -1;
+    metar->found |= METAR_F_VIS;
     if (verbose) {
       printf("   Ceiling and visibility OK\n");
       printf("   Visibility > 10 km\n");
@@ -442,111 +443,291 @@ static void analyse_token(char *token, metar_t *metar) {
     return;
   };
 
-  if (strstr(token, "SNOCLO") != NULL) {
-    add_stuff((stufflist_t **)&metar->stuff, "aerodrome closed due to snow");
+  if ((fields & METAR_F_OTHER) && len >= 5 &&
+      contains(token, len, "SNOCLO")) {
+    add_stuff(metar, METAR_SNOCLO);
     if (verbose) printf("   Aerodrome closed due to snow\n");
     return;
   };
 
-  if (strstr(token, "NOSIG") != NULL) {
-    add_stuff((stufflist_t **)&metar->stuff, "no significant change expected within 2 hours");
+  if ((fields & METAR_F_OTHER) && len >= 5 &&
+      contains(token, len, "NOSIG")) {
+    add_stuff(metar, METAR_NOSIG);
     if (verbose) printf("   No significant change expected within 2 hours\n");
     return;
   };
 
-  if (regcomp(&preg, obsp, REG_EXTENDED)) {
-    perror("parsemetar");
-    exit(errno);
+  // phenomena
+  if ((fields & METAR_F_WEATHER) && match_phenomena(token, len, &obs)) {
+    if (!add_observation(metar, &obs)) {
+      if (verbose) printf("   Too many phenomena\n");
+    } else if (verbose)
+      printf("   Phenomena %s\n", metar_obs_text(&obs, text, sizeof(text)));
+    return;
   }
-  if (!regexec(&preg, token, 5, pmatch, 0)) {
-    char *obs;
-    obs = malloc(99);
-    memset(obs, 0x0, 99);
-
-    size=pmatch[1].rm_eo - pmatch[1].rm_so;
-    memset(tmp, 0x0, 99);
-    memcpy(tmp, token+pmatch[1].rm_so, (size < 1 ? size : 1));
-    if (tmp[0] == '-') strncpy(obs, "light ", 99);
-    else if (tmp[0] == '+') strncpy(obs, "heavy ", 99);
-
-    // split up in groups of 2 chars and decode per group
-    size=pmatch[2].rm_eo - pmatch[2].rm_so;
-    memset(tmp, 0x0, 99);
-    memcpy(tmp, token+pmatch[2].rm_so, (size < 99 ? size : 99));
-
-    int i=0;
-    char code[2];
-    while (i < strlen(tmp)) {
-      memset(code, 0x0, 2);
-      memcpy(code, tmp+i, 2);
-      strncat(obs, decode_obs(code), 99);
-      i += 2;
-    }
 
-    // remove trailing space
-    obs[strlen(obs)-1]=0;
-    add_observation((obslist_t **)&metar->obs, obs);
-    if (verbose)
-      printf("   Phenomena %s\n", obs);
+  if (verbose) printf("   Unmatched token = %.*s\n", len, token);
+}
 
-    return;
-  }
 
-  if (verbose) printf("   Unmatched token = %s\n", token);
+/* The single fields which can't change any more, by the same tests as
+ * analyse_token() uses. Visibility is final only as set by CAVOK, which
+ * overrides a visibility group.
+ */
+static unsigned int final_fields(const metar_t *metar) {
+  return (metar->station[0] != 0) * METAR_F_STATION |
+    ((int)metar->day != 0) * METAR_F_TIME |
+    ((int)metar->winddir != 0) * METAR_F_WIND |
+    (metar->vis == -1) * METAR_F_VIS |
+    ((int)metar->temp != 0) * METAR_F_TEMP |
+    ((int)metar->qnh != 0) * METAR_F_QNH;
 }
 
 
+/* PUBLIC--
+ * Set the default parsing options and unit conversions.
+ */
+void metar_ctx_init(metar_ctx_t *ctx) {
+  memset(ctx, 0x0, sizeof(metar_ctx_t));
+  strcpy(ctx->wind_convfrom, "KT");
+  strcpy(ctx->wind_convto, "m/s");
+  ctx->wind_convfac = 0.514444;
+  ctx->fields = METAR_F_ALL;
+} // metar_ctx_init
+
+
+static const struct {
+  const char  *name;
+  unsigned int field;
+} field_names[] = {
+  { "station", METAR_F_STATION }, { "time", METAR_F_TIME },
+  { "wind", METAR_F_WIND }, { "vis", METAR_F_VIS },
+  { "visibility", METAR_F_VIS }, { "temp", METAR_F_TEMP },
+  { "dewpoint", METAR_F_TEMP }, { "qnh", METAR_F_QNH },
+  { "pressure", METAR_F_QNH }, { "clouds", METAR_F_CLOUDS },
+  { "weather", METAR_F_WEATHER }, { "other", METAR_F_OTHER },
+  { "all", METAR_F_ALL }
+};
+
+
+/* PUBLIC--
+ * Parse a list of field names into METAR_F_* bits.
+ */
+int metar_fields(const char *list, unsigned int *fields) {
+  const char *p = list, *end;
+  size_t i, len;
+
+  *fields = METAR_F_STATION;
+  do {
+    end = strchr(p, ',');
+    len = end ? (size_t)(end - p) : strlen(p);
+    for (i = 0; i < sizeof(field_names) / sizeof(field_names[0]); i++)
+      if (strlen(field_names[i].name) == len &&
+	  strncmp(field_names[i].name, p, len) == 0) break;
+    if (i == sizeof(field_names) / sizeof(field_names[0])) return 1;
+    *fields |= field_names[i].field;
+    p = end + 1;
+  } while (end);
+  return 0;
+} // metar_fields
+
+
+/* PUBLIC--
+ * Describe a weather phenomena group in text, eg. "light snow".
+ */
+char *metar_obs_text(const metar_obs_t *obs, char *buf, size_t size) {
+  const char *desc;
+  size_t n = 0, len;
+  int i;
+
+  if (size == 0) return buf;
+  buf[0] = 0;
+  if (obs->intensity)
+    desc = (obs->intensity < 0) ? "light " : "heavy ";
+  else
+    desc = "";
+
+  for (i = -1; i < obs->ncodes; i++) {
+    if (i >= 0) desc = observations[obs->codes[i]].description;
+    len = strlen(desc);
+    if (n + len >= size) break;
+    memcpy(buf + n, desc, len + 1);
+    n += len;
+  }
+
+  // remove trailing space
+  if (n) buf[n-1] = 0;
+  return buf;
+} // metar_obs_text
+
+
+/* PUBLIC--
+ * Clear the metar struct for the next report. Only the scalar fields and
+ * the counts of the inline arrays are cleared.
+ */
+void metar_reset(metar_t *metar) {
+  memset(metar, 0x0, offsetof(metar_t, clouds));
+} // metar_reset
+
+
+/* PUBLIC--
+ * Parse the METAR contained in the first len bytes of report, up to the
+ * first newline, using the options of ctx. Place the parsed report in the
+ * metar struct. The report is left untouched and no global state is used.
+ */
+void parse_Metar_n(const metar_ctx_t *ctx, const char *report, size_t len,
+		   metar_t *metar) {
+  metar_token_t tokens[TOKEN_MAX];
+  unsigned int stop;
+  int i, n, done = 0;
+  size_t used;
+
+  /* clear results */
+  metar_reset(metar);
+  metar->omitted = METAR_F_ALL & ~(ctx->fields | METAR_F_STATION);
+
+  /* without lists wanted, the report is read until the fields are known */
+  stop = (ctx->fields & METAR_F_LISTS) ? 0 : ctx->fields | METAR_F_STATION;
+
+  while (!done) {
+    used = metar_tokenize(report, len, tokens, TOKEN_MAX, &n, &done);
+    for (i = 0; i < n; i++) {
+      analyse_token(ctx, report + tokens[i].start, tokens[i].len,
+		    tokens[i].hints, metar);
+      if (stop && (final_fields(metar) & stop) == stop) return;
+    }
+    report += used;
+    len -= used;
+  }
+
+} // parse_Metar_n
+
+
+/* PUBLIC--
+ * Parse the METAR contained in the report string, see parse_Metar_n().
+ */
+void parse_Metar_r(const metar_ctx_t *ctx, const char *report,
+		   metar_t *metar) {
+  parse_Metar_n(ctx, report, strlen(report), metar);
+} // parse_Metar_r
+
+
 /* PUBLIC--
  * Parse the METAR contain in the report string. Place the parsed report in
  * the metar struct.
  */
 void parse_Metar(char *report, metar_t *metar) {
-  char *token;
+  metar_ctx_t ctx;
   char *last;
 
-  /* clear results */
-  memset(metar, 0x0, sizeof(metar_t));
+  metar_ctx_init(&ctx);
+  ctx.noconvert = metar_noconvert;
+  ctx.verbose = metar_verbose;
 
   // strip trailing newlines
   while ((last = strrchr(report, '\n')) != NULL)
     memset(last, 0, 1);
 
-  token = strtok(report, " ");
-  while (token != NULL) {
-    analyse_token(token, metar);
-    token = strtok(NULL, " ");
-  }
+  parse_Metar_r(&ctx, report, metar);
 
 } // parse_Metar
 
 
-/* parse the NOAA report contained in the noaa_data buffer. Place the parsed
- * data in the metar struct.
+/* PUBLIC--
+ * Parse the NOAA data, a "YYYY/MM/DD HH:MM" date line followed by the
+ * report, contained in the noaa_data buffer into the noaa struct.
+ * Returns 1 if the data isn't in NOAA format.
  */
-int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
-  regex_t preg;
-  regmatch_t pmatch[10];
-  int size;
+int parse_NOAA_data_r(const char *noaa_data, noaa_t *noaa) {
+  const char *p = noaa_data, *date;
+  size_t size;
+
+  /* date: ^[0-9/]+ [0-9:]+ */
+  date = p;
+  for (size = 0; IS_DIGIT(*p) || *p == '/'; p++) size++;
+  if (size == 0 || *p++ != ' ') return 1;
+  for (size = 0; IS_DIGIT(*p) || *p == ':'; p++) size++;
+  if (size == 0) return 1;
+
+  /* followed by whitespace */
+  if (!isspace((unsigned char)*p)) return 1;
+
+  memset(noaa, 0x0, sizeof(noaa_t));
+  size = p - date;
+  memcpy(noaa->date, date, (size < sizeof(noaa->date) ?
+			    size : sizeof(noaa->date) - 1));
+
+  /* the rest is the report */
+  while (isspace((unsigned char)*p)) p++;
+  size = strlen(p);
+  memcpy(noaa->report, p, (size < sizeof(noaa->report) ?
+			   size : sizeof(noaa->report) - 1));
+  return 0;
+} // parse_NOAA_data_r
+
+
+/* length of the NOAA date line "YYYY/MM/DD HH:MM" at p, 0 if there is none */
+static size_t date_length(const char *p, const char *end) {
+  const char *q = p;
+
+  while (q < end && (IS_DIGIT(*q) || *q == '/')) q++;
+  if (q == p || q == end || *q++ != ' ') return 0;
+  if (q == end || !(IS_DIGIT(*q) || *q == ':')) return 0;
+  while (q < end && (IS_DIGIT(*q) || *q == ':')) q++;
+  return q - p;
+}
 
-  if (regcomp(&preg, "^([0-9/]+ [0-9:]+)[[:space:]]+(.*)$", REG_EXTENDED)) {
-    fprintf(stderr, "Unable to compile regular expression.\n");
-    exit(errno);
-  }
 
-  if (regexec(&preg, noaa_data, 10, pmatch, 0)) {
-    /* moved to main.c where the return value of this function is checked:
-    fprintf(stderr, "METAR pattern not found in NOAA data.\n"); */
-    return 1;
-  } else {
-    memset(noaa, 0x0, sizeof(noaa_t));
-    /* date */
-    size = pmatch[1].rm_eo - pmatch[1].rm_so;
-    memcpy(noaa->date, noaa_data+pmatch[1].rm_so, (size < 36 ? size : 36));
-
-    /* metar */
-    size = pmatch[2].rm_eo - pmatch[2].rm_so;
-    memcpy(noaa->report, noaa_data+pmatch[2].rm_so,
-	   (size < 1024 ? size : 1024));
-    return 0;
+/* PUBLIC--
+ * Find the next record in the NOAA data between p and end. Records are
+ * reports on their own line, optionally preceded by a date line, as in
+ * NOAA station and cycle files. The record points into the data, nothing
+ * is copied. Returns the position after the record, or NULL if there is no
+ * complete record left; unless eof is set, the last line only counts when
+ * it is terminated.
+ */
+const char *next_NOAA_record(const char *p, const char *end, int eof,
+			     noaa_rec_t *rec) {
+  const char *line, *eol;
+  size_t n;
+
+  memset(rec, 0x0, sizeof(noaa_rec_t));
+
+  for (;;) {
+    /* skip blank lines */
+    while (p < end && isspace((unsigned char)*p)) p++;
+    if (p == end) return NULL;
+
+    line = p;
+    if ((eol = memchr(p, '\n', end - p)) == NULL) {
+      if (!eof) return NULL;
+      eol = end;
+    }
+    p = (eol < end) ? eol + 1 : end;
+
+    /* trailing whitespace is not part of the line */
+    while (eol > line && isspace((unsigned char)eol[-1])) eol--;
+
+    n = date_length(line, eol);
+    if (n && n == (size_t)(eol - line)) {
+      /* date line, the report follows on the next line */
+      if (rec->date == NULL) {
+	rec->date = line;
+	rec->datelen = n;
+      }
+      continue;
+    }
+
+    rec->report = line;
+    rec->reportlen = eol - line;
+    return p;
   }
+} // next_NOAA_record
+
+
+/* parse the NOAA report contained in the noaa_data buffer. Place the parsed
+ * data in the metar struct.
+ */
+int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
+  return parse_NOAA_data_r(noaa_data, noaa);
 } // parse_NOAA_data
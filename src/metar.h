@@ -22,37 +22,55 @@
 /* max size for a URL */
 #define URL_MAXSIZE 300
 
-/* max size for a NOAA report */
-#define METAR_MAXSIZE 512
-
 /* where to fetch reports */
 #define METARURL "http://tgftp.nws.noaa.gov/data/observations/metar/stations"
 
+/* capacities of the inline arrays of a report */
+#define METAR_MAXCLOUDS 8	// cloud layers
+#define METAR_MAXOBS    8	// weather phenomena groups
+#define METAR_MAXSTUFF  8	// CAVOK, NOSIG etc.
+
+/* descriptions of the other stuff reported */
+#define METAR_CAVOK  "ceiling and visibility OK"
+#define METAR_SNOCLO "aerodrome closed due to snow"
+#define METAR_NOSIG  "no significant change expected within 2 hours"
+
+/* max number of codes kept of a weather phenomena group */
+#define METAR_MAXCODES 8
+
+/* buffer size for the text description of a weather phenomena group */
+#define METAR_OBSSIZE 99
+
+/* fields of a report, for decoding only some of them */
+#define METAR_F_STATION 0x001	// always decoded
+#define METAR_F_TIME    0x002	// day and time
+#define METAR_F_WIND    0x004
+#define METAR_F_VIS     0x008
+#define METAR_F_TEMP    0x010	// temperature and dewpoint
+#define METAR_F_QNH     0x020
+#define METAR_F_CLOUDS  0x040
+#define METAR_F_WEATHER 0x080
+#define METAR_F_OTHER   0x100	// CAVOK, NOSIG etc.
+#define METAR_F_ALL     0x1ff
+
+/* the fields which may appear any number of times in a report */
+#define METAR_F_LISTS (METAR_F_CLOUDS | METAR_F_WEATHER | METAR_F_OTHER)
+
 /* clouds */
 typedef struct {
-  char type[3];
+  char type[4];
   int  level;
 } cloud_t;
 
-/* linked list of clouds */
-typedef struct cloudlist_el {
-  cloud_t *cloud;
-  struct cloudlist_el *next;
-} cloudlist_t;
-
-/* linked list of observations */
-typedef struct obslist_el {
-  char *obs;
-  struct obslist_el *next;
-} obslist_t;
-
-/* linked list of other stuff */
-typedef struct stufflist_el {
-  char *stuff;
-  struct stufflist_el *next;
-} stufflist_t;
-
-/* reports will be translated to this struct */
+/* weather phenomena group, eg. -SHRA; decoded to text only on output */
+typedef struct {
+  signed char   intensity;	// -1 light, 0 moderate, 1 heavy
+  unsigned char ncodes;
+  unsigned char codes[METAR_MAXCODES];	// WMO 4678 code table indexes
+} metar_obs_t;
+
+/* reports will be translated to this struct; it owns no memory, so
+ * parsing needs no allocations and reports can be copied freely */
 typedef struct {
   char  station[10];
   int   day;
@@ -68,9 +86,15 @@ typedef struct {
   int   qnhfp;	// fixed-point decimal places
   int   temp;
   int   dewp;
-  cloudlist_t *clouds;
-  obslist_t *obs;
-  stufflist_t *stuff;
+  unsigned int omitted;	// METAR_F_* not decoded, left empty
+  unsigned int found;	// METAR_F_* single fields found in the report
+  int   nclouds;
+  int   nobs;
+  int   nstuff;
+  /* the arrays are only valid up to their counts */
+  cloud_t clouds[METAR_MAXCLOUDS];
+  metar_obs_t obs[METAR_MAXOBS];
+  const char *stuff[METAR_MAXSTUFF];
 } metar_t;
 
 typedef struct {
@@ -78,11 +102,85 @@ typedef struct {
   char report[1024];
 } noaa_t;
 
+/* a record of NOAA data, pointing into the data itself */
+typedef struct {
+  const char *date;
+  size_t datelen;
+  const char *report;
+  size_t reportlen;
+} noaa_rec_t;
+
+/* parsing options and unit conversions, see metar_ctx_init() for defaults */
+typedef struct {
+  int   verbose;	// print parsing progress to stdout
+  int   noconvert;	// don't convert wind units
+  /* from? if this matches, the conversion will be made */
+  char  wind_convfrom[5];
+  /* to? if you change this, make sure your unit fits into char windunit[5] */
+  char  wind_convto[5];
+  /* what is the conversion factor? */
+  float wind_convfac;
+  /* METAR_F_* to decode; the parser skips the others and stops as soon
+     as all of these are known */
+  unsigned int fields;
+} metar_ctx_t;
+
+/* Set the default options: wind is converted from knots to m/s and all
+ * fields are decoded. */
+void metar_ctx_init(metar_ctx_t *ctx);
+
+/* Parse a comma separated list of field names, such as "temp,wind,qnh",
+ * into METAR_F_* bits. Returns 1 if a name is unknown.
+ */
+int metar_fields(const char *list, unsigned int *fields);
+
+/* Clear a report for reuse. This is constant time: the inline arrays are
+ * only invalidated, not cleared.
+ */
+void metar_reset(metar_t *metar);
+
+/* Describe a weather phenomena group in text, eg. "light snow", into the
+ * buffer of size bytes. Returns buf.
+ */
+char *metar_obs_text(const metar_obs_t *obs, char *buf, size_t size);
+
+/* Parse the METAR contained in the report string using the options of ctx.
+ * Place the parsed report in the metar struct. The report is not modified
+ * and no global state is touched, so this is safe to call from several
+ * threads as long as each one uses its own metar struct.
+ */
+void parse_Metar_r(const metar_ctx_t *ctx, const char *report,
+		   metar_t *metar);
+
+/* As parse_Metar_r(), for a report of len bytes which need not be nul
+ * terminated.
+ */
+void parse_Metar_n(const metar_ctx_t *ctx, const char *report, size_t len,
+		   metar_t *metar);
+
+/* options of parse_Metar(), as in metar_ctx_t; both 0 by default */
+extern int metar_verbose;
+extern int metar_noconvert;
+
 /* Parse the METAR contain in the report string. Place the parsed report in
- * the metar struct.
+ * the metar struct. Uses the global metar_verbose and metar_noconvert
+ * options. Trailing newlines are stripped from the report.
  */
 void parse_Metar(char *report, metar_t *metar);
 
+/* Parse the NOAA data contained in the noaa_data buffer into the noaa
+ * struct. Reentrant. Returns 1 if no report is found.
+ */
+int parse_NOAA_data_r(const char *noaa_data, noaa_t *noaa);
+
+/* Find the next date+report record in the NOAA data between p and end
+ * without copying it. Returns the position after the record, or NULL when
+ * no complete record is left. Unless eof is set, an unterminated last line
+ * is not considered complete.
+ */
+const char *next_NOAA_record(const char *p, const char *end, int eof,
+			     noaa_rec_t *rec);
+
 /* parse the NOAA report contained in the noaa_data buffer. Place a parsed
  * data in the metar struct.
  */
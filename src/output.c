@@ -0,0 +1,677 @@
+/*
+  output.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metar.h"
+#include "output.h"
+#include "station.h"
+
+static const char *winddirs[] = {
+  "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
+  "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW"
+};
+
+/* 16-point compass direction of degrees */
+#define COMPASS(dir) winddirs[(((dir) * 4 + 45) / 90) % 16]
+
+
+/* PUBLIC--
+ * Set up an output buffer.
+ */
+void outbuf_init(outbuf_t *ob, FILE *out) {
+  ob->size = out ? OUTBUF_SIZE : 256;
+  ob->buf = malloc(ob->size);
+  ob->buf[0] = 0;
+  ob->len = 0;
+  ob->out = out;
+} // outbuf_init
+
+
+/* PUBLIC--
+ * Write out the buffered text.
+ */
+int outbuf_flush(outbuf_t *ob) {
+  int res = 0;
+
+  if (ob->out && ob->len) {
+    res = fwrite(ob->buf, 1, ob->len, ob->out) != ob->len;
+    ob->len = 0;
+    ob->buf[0] = 0;
+  }
+  return res;
+} // outbuf_flush
+
+
+/* PUBLIC--
+ * Release the buffer.
+ */
+void outbuf_free(outbuf_t *ob) {
+  free(ob->buf);
+  memset(ob, 0x0, sizeof(outbuf_t));
+} // outbuf_free
+
+
+/* make room for len more bytes and the terminating nul */
+static void outbuf_reserve(outbuf_t *ob, size_t len) {
+  if (ob->len + len < ob->size) return;
+  if (ob->out) {
+    outbuf_flush(ob);
+    if (len < ob->size) return;
+  }
+  while (ob->len + len >= ob->size) ob->size *= 2;
+  ob->buf = realloc(ob->buf, ob->size);
+}
+
+
+/* PUBLIC--
+ * Append text.
+ */
+void outbuf_write(outbuf_t *ob, const char *s, size_t len) {
+  outbuf_reserve(ob, len);
+  memcpy(ob->buf + ob->len, s, len);
+  ob->len += len;
+  ob->buf[ob->len] = 0;
+} // outbuf_write
+
+
+/* PUBLIC--
+ * Append a string.
+ */
+void outbuf_puts(outbuf_t *ob, const char *s) {
+  outbuf_write(ob, s, strlen(s));
+} // outbuf_puts
+
+
+/* PUBLIC--
+ * Append a character.
+ */
+void outbuf_putc(outbuf_t *ob, char c) {
+  outbuf_reserve(ob, 1);
+  ob->buf[ob->len++] = c;
+  ob->buf[ob->len] = 0;
+} // outbuf_putc
+
+
+/* PUBLIC--
+ * Append formatted text, for the rare messages only.
+ */
+void outbuf_printf(outbuf_t *ob, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    ob->buf[ob->len] = 0;
+    return;
+  }
+  if (ob->len + n >= ob->size) {
+    outbuf_reserve(ob, n);
+    va_start(ap, fmt);
+    vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+    va_end(ap);
+  }
+  ob->len += n;
+} // outbuf_printf
+
+
+/* PUBLIC--
+ * Append an integer.
+ */
+void outbuf_int(outbuf_t *ob, long value, int width) {
+  char digits[24], *p = digits + sizeof(digits);
+  unsigned long v = (value < 0) ? -(unsigned long)value : value;
+
+  do {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (digits + sizeof(digits) - p < width) *--p = '0';
+  if (value < 0) *--p = '-';
+  outbuf_write(ob, p, digits + sizeof(digits) - p);
+} // outbuf_int
+
+
+/* PUBLIC--
+ * Append a value with one decimal. A float times ten is exact in a
+ * double, so ties are found exactly and rounded to even like printf().
+ */
+void outbuf_fixed1(outbuf_t *ob, float value) {
+  double v = (double)value * 10;
+  long tenths;
+
+  if (v < 0) v = -v;
+  tenths = (long)v;
+  if (v - tenths > 0.5 || (v - tenths == 0.5 && (tenths & 1))) tenths++;
+  if (value < 0) outbuf_putc(ob, '-');
+  outbuf_int(ob, tenths / 10, 0);
+  outbuf_putc(ob, '.');
+  outbuf_putc(ob, '0' + tenths % 10);
+} // outbuf_fixed1
+
+
+/* PUBLIC--
+ * Append a scaled integer.
+ */
+void outbuf_decimal(outbuf_t *ob, long value, int decimals) {
+  long scale = 1;
+  int i;
+
+  for (i = 0; i < decimals; i++) scale *= 10;
+  if (value < 0) {
+    outbuf_putc(ob, '-');
+    value = -value;
+  }
+  outbuf_int(ob, value / scale, 0);
+  if (decimals > 0) {
+    outbuf_putc(ob, '.');
+    outbuf_int(ob, value % scale, decimals);
+  }
+} // outbuf_decimal
+
+
+/* time as HH:MM */
+static void put_time(outbuf_t *ob, int time) {
+  outbuf_int(ob, time / 100, 2);
+  outbuf_putc(ob, ':');
+  outbuf_int(ob, time % 100, 2);
+}
+
+
+/* was the field decoded, see metar_t.omitted */
+#define HAS(metar, field) (((metar)->omitted & (field)) == 0)
+
+/* the continuation indent of the full decode, as "%15s " */
+#define INDENT "                "
+
+
+/* decode metar */
+void decode_Metar(outbuf_t *ob, const metar_t *metar) {
+  const station_t *station = station_lookup(metar->station);
+  char text[METAR_OBSSIZE];
+  int i;
+  int n = 0;
+  int m = 0;
+
+  outbuf_puts(ob, "Station       : ");
+  outbuf_puts(ob, metar->station);
+  if (station) {
+    outbuf_puts(ob, "\nName          : ");
+    outbuf_puts(ob, station->name);
+    outbuf_puts(ob, ", ");
+    outbuf_puts(ob, station->country);
+  }
+  outbuf_putc(ob, '\n');
+  if (HAS(metar, METAR_F_TIME)) {
+    outbuf_puts(ob, "Day           : ");
+    outbuf_int(ob, metar->day, 0);
+    outbuf_puts(ob, "\nTime          : ");
+    put_time(ob, metar->time);
+    outbuf_puts(ob, " UTC\n");
+  }
+  if (HAS(metar, METAR_F_WIND)) {
+    if (metar->winddir == -1) {
+      outbuf_puts(ob, "Wind direction: Variable\n");
+    } else {
+      outbuf_puts(ob, "Wind direction: ");
+      outbuf_int(ob, metar->winddir, 0);
+      outbuf_puts(ob, " (");
+      outbuf_puts(ob, COMPASS(metar->winddir));
+      outbuf_puts(ob, ")\n");
+    }
+    outbuf_puts(ob, "Wind speed    : ");
+    outbuf_fixed1(ob, metar->windstr);
+    outbuf_putc(ob, ' ');
+    outbuf_puts(ob, metar->windunit);
+    outbuf_putc(ob, '\n');
+    if (metar->windstr != metar->windgust) {
+      outbuf_puts(ob, "Wind gust     : ");
+      outbuf_fixed1(ob, metar->windgust);
+      outbuf_putc(ob, ' ');
+      outbuf_puts(ob, metar->windunit);
+      outbuf_putc(ob, '\n');
+    }
+  }
+
+  /* visibility: treat 9999 m specially */
+  if (HAS(metar, METAR_F_VIS) && metar->vis == -1) {
+    outbuf_puts(ob, "Visibility    : > 10 km\n");
+  } else if (HAS(metar, METAR_F_VIS)) {
+    outbuf_puts(ob, "Visibility    : ");
+    outbuf_int(ob, metar->vis, 0);
+    outbuf_putc(ob, ' ');
+    outbuf_puts(ob, metar->visunit);
+    outbuf_putc(ob, '\n');
+  }
+  if (HAS(metar, METAR_F_TEMP)) {
+    outbuf_puts(ob, "Temperature   : ");
+    outbuf_int(ob, metar->temp, 0);
+    outbuf_puts(ob, " C\nDewpoint      : ");
+    outbuf_int(ob, metar->dewp, 0);
+    outbuf_puts(ob, " C\n");
+  }
+  if (HAS(metar, METAR_F_QNH)) {
+    outbuf_puts(ob, "Pressure      : ");
+    outbuf_decimal(ob, metar->qnh, metar->qnhfp);
+    outbuf_putc(ob, ' ');
+    outbuf_puts(ob, metar->qnhunit);
+    outbuf_putc(ob, '\n');
+  }
+
+  if (HAS(metar, METAR_F_CLOUDS)) {
+    outbuf_puts(ob, "Clouds        : ");
+    n = 0;
+    for (i = 0; i < metar->nclouds; i++) {
+      if (n++) outbuf_puts(ob, INDENT);
+      outbuf_puts(ob, metar->clouds[i].type);
+      outbuf_puts(ob, " at ");
+      outbuf_int(ob, metar->clouds[i].level, 0);
+      outbuf_puts(ob, "00 ft\n");
+    }
+    if (!n) outbuf_putc(ob, '\n');
+  }
+
+  if (!HAS(metar, METAR_F_WEATHER) && !HAS(metar, METAR_F_OTHER)) return;
+  outbuf_puts(ob, "Conditions    : ");
+  n = 0;
+  for (i = 0; i < metar->nobs; i++) {
+    if (n++) outbuf_puts(ob, INDENT);
+    outbuf_puts(ob, metar_obs_text(&metar->obs[i], text, sizeof(text)));
+    outbuf_putc(ob, '\n');
+  }
+  m = 0;
+  for (i = 0; i < metar->nstuff; i++) {
+    if (m++) outbuf_puts(ob, INDENT);
+    outbuf_puts(ob, metar->stuff[i]);
+    outbuf_putc(ob, '\n');
+  }
+  if (!n && !m) outbuf_putc(ob, '\n');
+}
+
+
+/* decode METAR without line breaks */
+void shortdecode_Metar(outbuf_t *ob, const metar_t *metar, int extra) {
+  const station_t *station;
+  char text[METAR_OBSSIZE];
+  int i;
+
+  outbuf_puts(ob, metar->station);
+  if (extra && (station = station_lookup(metar->station)) != NULL) {
+    outbuf_puts(ob, " (");
+    outbuf_puts(ob, station->name);
+    outbuf_puts(ob, ", ");
+    outbuf_puts(ob, station->country);
+    outbuf_putc(ob, ')');
+  }
+  if (HAS(metar, METAR_F_TIME)) {
+    outbuf_puts(ob, " day ");
+    outbuf_int(ob, metar->day, 0);
+    outbuf_puts(ob, " time ");
+    put_time(ob, metar->time);
+    outbuf_puts(ob, " UTC");
+  }
+  if (HAS(metar, METAR_F_TEMP)) {
+    outbuf_puts(ob, ", temp ");
+    outbuf_int(ob, metar->temp, 0);
+    outbuf_puts(ob, " C");
+  }
+
+  if (HAS(metar, METAR_F_WIND)) {
+    outbuf_puts(ob, ", ");
+    /* if wind gust is different from wind str, include indication */
+    if (metar->windgust != metar->windstr) outbuf_puts(ob, "gusty ");
+
+    outbuf_puts(ob, "wind ");
+    outbuf_fixed1(ob, metar->windstr);
+    outbuf_putc(ob, ' ');
+    outbuf_puts(ob, metar->windunit);
+
+    if (metar->winddir != -1) {
+      outbuf_puts(ob, " from ");
+      outbuf_puts(ob, COMPASS(metar->winddir));
+    }
+  }
+
+  if (extra && HAS(metar, METAR_F_QNH)) {
+    outbuf_puts(ob, ", pressure ");
+    outbuf_decimal(ob, metar->qnh, metar->qnhfp);
+    outbuf_putc(ob, ' ');
+    outbuf_puts(ob, metar->qnhunit);
+  }
+
+  /* print observations */
+  for (i = 0; i < metar->nobs; i++) {
+    outbuf_puts(ob, ", ");
+    outbuf_puts(ob, metar_obs_text(&metar->obs[i], text, sizeof(text)));
+  }
+
+  if (extra) {
+    if (!HAS(metar, METAR_F_VIS)) {
+      /* not decoded */
+    } else if (metar->vis == -1) {
+      outbuf_puts(ob, ", visibility over 10 km");
+    } else {
+      outbuf_puts(ob, ", visibility ");
+      outbuf_int(ob, metar->vis, 0);
+      outbuf_putc(ob, ' ');
+      outbuf_puts(ob, metar->visunit);
+    }
+
+    for (i = 0; i < metar->nstuff; i++) {
+      outbuf_puts(ob, ", ");
+      outbuf_puts(ob, metar->stuff[i]);
+    }
+
+    for (i = 0; i < metar->nclouds; i++) {
+      outbuf_puts(ob, (i == 0) ? ", clouds: " : " ");
+      outbuf_puts(ob, metar->clouds[i].type);
+      outbuf_puts(ob, " at ");
+      outbuf_int(ob, metar->clouds[i].level, 0);
+      outbuf_puts(ob, "00 ft;");
+    }
+  }
+  outbuf_putc(ob, '\n');
+}
+
+
+/* a JSON string */
+static void json_string(outbuf_t *ob, const char *s) {
+  const char *p, *run;
+
+  outbuf_putc(ob, '"');
+  for (p = run = s; *p; p++) {
+    if (*p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) continue;
+    outbuf_write(ob, run, p - run);
+    run = p + 1;
+    if (*p == '"' || *p == '\\') {
+      outbuf_putc(ob, '\\');
+      outbuf_putc(ob, *p);
+    } else {
+      outbuf_puts(ob, "\\u00");
+      outbuf_putc(ob, "0123456789abcdef"[(*p >> 4) & 0xf]);
+      outbuf_putc(ob, "0123456789abcdef"[*p & 0xf]);
+    }
+  }
+  outbuf_write(ob, run, p - run);
+  outbuf_putc(ob, '"');
+}
+
+
+/* a JSON member name */
+static void json_key(outbuf_t *ob, const char *key, int first) {
+  if (!first) outbuf_putc(ob, ',');
+  outbuf_putc(ob, '"');
+  outbuf_puts(ob, key);
+  outbuf_puts(ob, "\":");
+}
+
+
+/* report as JSON */
+void json_Metar(outbuf_t *ob, const metar_t *metar) {
+  const station_t *station = station_lookup(metar->station);
+  char text[METAR_OBSSIZE];
+  int i;
+
+  outbuf_putc(ob, '{');
+  json_key(ob, "station", 1);
+  json_string(ob, metar->station);
+  if (station) {
+    json_key(ob, "name", 0);
+    json_string(ob, station->name);
+    json_key(ob, "country", 0);
+    json_string(ob, station->country);
+  }
+  if (HAS(metar, METAR_F_TIME)) {
+    json_key(ob, "day", 0);
+    outbuf_int(ob, metar->day, 0);
+    json_key(ob, "time", 0);
+    outbuf_putc(ob, '"');
+    put_time(ob, metar->time);
+    outbuf_putc(ob, '"');
+  }
+
+  /* null direction for variable wind */
+  if (HAS(metar, METAR_F_WIND)) {
+    json_key(ob, "wind_dir", 0);
+    if (metar->winddir == -1) outbuf_puts(ob, "null");
+    else outbuf_int(ob, metar->winddir, 0);
+    json_key(ob, "wind_speed", 0);
+    outbuf_fixed1(ob, metar->windstr);
+    json_key(ob, "wind_gust", 0);
+    outbuf_fixed1(ob, metar->windgust);
+    json_key(ob, "wind_unit", 0);
+    json_string(ob, metar->windunit);
+  }
+
+  /* null visibility for 10 km or more */
+  if (HAS(metar, METAR_F_VIS)) {
+    json_key(ob, "visibility", 0);
+    if (metar->vis == -1) outbuf_puts(ob, "null");
+    else outbuf_int(ob, metar->vis, 0);
+    json_key(ob, "visibility_unit", 0);
+    json_string(ob, metar->visunit);
+  }
+
+  if (HAS(metar, METAR_F_TEMP)) {
+    json_key(ob, "temp", 0);
+    outbuf_int(ob, metar->temp, 0);
+    json_key(ob, "dewpoint", 0);
+    outbuf_int(ob, metar->dewp, 0);
+  }
+  if (HAS(metar, METAR_F_QNH)) {
+    json_key(ob, "pressure", 0);
+    outbuf_decimal(ob, metar->qnh, metar->qnhfp);
+    json_key(ob, "pressure_unit", 0);
+    json_string(ob, metar->qnhunit);
+  }
+
+  if (HAS(metar, METAR_F_CLOUDS)) {
+    json_key(ob, "clouds", 0);
+    outbuf_putc(ob, '[');
+    for (i = 0; i < metar->nclouds; i++) {
+      outbuf_puts(ob, i ? ",{" : "{");
+      json_key(ob, "type", 1);
+      json_string(ob, metar->clouds[i].type);
+      json_key(ob, "level", 0);
+      outbuf_int(ob, metar->clouds[i].level * 100, 0);
+      outbuf_putc(ob, '}');
+    }
+    outbuf_putc(ob, ']');
+  }
+
+  if (HAS(metar, METAR_F_WEATHER)) {
+    json_key(ob, "weather", 0);
+    outbuf_putc(ob, '[');
+    for (i = 0; i < metar->nobs; i++) {
+      if (i) outbuf_putc(ob, ',');
+      json_string(ob, metar_obs_text(&metar->obs[i], text, sizeof(text)));
+    }
+    outbuf_putc(ob, ']');
+  }
+
+  if (HAS(metar, METAR_F_OTHER)) {
+    json_key(ob, "other", 0);
+    outbuf_putc(ob, '[');
+    for (i = 0; i < metar->nstuff; i++) {
+      if (i) outbuf_putc(ob, ',');
+      json_string(ob, metar->stuff[i]);
+    }
+    outbuf_putc(ob, ']');
+  }
+  outbuf_putc(ob, '}');
+}
+
+
+/* text inside a quoted CSV field */
+static void csv_quoted(outbuf_t *ob, const char *s) {
+  const char *p;
+
+  for (p = s; *p; p++) {
+    if (*p == '"') outbuf_putc(ob, '"');
+    outbuf_putc(ob, *p);
+  }
+}
+
+
+/* a CSV field, quoted when needed */
+static void csv_string(outbuf_t *ob, const char *s) {
+  if (strpbrk(s, ",\"\r\n") == NULL) {
+    outbuf_puts(ob, s);
+    return;
+  }
+  outbuf_putc(ob, '"');
+  csv_quoted(ob, s);
+  outbuf_putc(ob, '"');
+}
+
+
+/* PUBLIC--
+ * Print the CSV header line of the fields.
+ */
+void csv_header(outbuf_t *ob, unsigned int fields) {
+  outbuf_puts(ob, "station");
+  if (fields & METAR_F_TIME) outbuf_puts(ob, ",day,time");
+  if (fields & METAR_F_WIND)
+    outbuf_puts(ob, ",wind_dir,wind_speed,wind_gust,wind_unit");
+  if (fields & METAR_F_VIS) outbuf_puts(ob, ",visibility,visibility_unit");
+  if (fields & METAR_F_TEMP) outbuf_puts(ob, ",temp,dewpoint");
+  if (fields & METAR_F_QNH) outbuf_puts(ob, ",pressure,pressure_unit");
+  if (fields & METAR_F_CLOUDS) outbuf_puts(ob, ",clouds");
+  if (fields & METAR_F_WEATHER) outbuf_puts(ob, ",weather");
+  if (fields & METAR_F_OTHER) outbuf_puts(ob, ",other");
+  outbuf_putc(ob, '\n');
+} // csv_header
+
+
+/* report as a CSV line; lists are separated by semicolons, and empty
+   direction and visibility stand for variable wind and 10 km or more */
+void csv_Metar(outbuf_t *ob, const metar_t *metar) {
+  char text[METAR_OBSSIZE];
+  int i;
+
+  csv_string(ob, metar->station);
+  if (HAS(metar, METAR_F_TIME)) {
+    outbuf_putc(ob, ',');
+    outbuf_int(ob, metar->day, 0);
+    outbuf_putc(ob, ',');
+    put_time(ob, metar->time);
+  }
+  if (HAS(metar, METAR_F_WIND)) {
+    outbuf_putc(ob, ',');
+    if (metar->winddir != -1) outbuf_int(ob, metar->winddir, 0);
+    outbuf_putc(ob, ',');
+    outbuf_fixed1(ob, metar->windstr);
+    outbuf_putc(ob, ',');
+    outbuf_fixed1(ob, metar->windgust);
+    outbuf_putc(ob, ',');
+    csv_string(ob, metar->windunit);
+  }
+  if (HAS(metar, METAR_F_VIS)) {
+    outbuf_putc(ob, ',');
+    if (metar->vis != -1) outbuf_int(ob, metar->vis, 0);
+    outbuf_putc(ob, ',');
+    csv_string(ob, metar->visunit);
+  }
+  if (HAS(metar, METAR_F_TEMP)) {
+    outbuf_putc(ob, ',');
+    outbuf_int(ob, metar->temp, 0);
+    outbuf_putc(ob, ',');
+    outbuf_int(ob, metar->dewp, 0);
+  }
+  if (HAS(metar, METAR_F_QNH)) {
+    outbuf_putc(ob, ',');
+    outbuf_decimal(ob, metar->qnh, metar->qnhfp);
+    outbuf_putc(ob, ',');
+    csv_string(ob, metar->qnhunit);
+  }
+
+  /* the lists are always quoted */
+  if (HAS(metar, METAR_F_CLOUDS)) {
+    outbuf_puts(ob, ",\"");
+    for (i = 0; i < metar->nclouds; i++) {
+      if (i) outbuf_putc(ob, ';');
+      csv_quoted(ob, metar->clouds[i].type);
+      outbuf_putc(ob, ' ');
+      outbuf_int(ob, metar->clouds[i].level * 100, 0);
+    }
+    outbuf_putc(ob, '"');
+  }
+  if (HAS(metar, METAR_F_WEATHER)) {
+    outbuf_puts(ob, ",\"");
+    for (i = 0; i < metar->nobs; i++) {
+      if (i) outbuf_putc(ob, ';');
+      csv_quoted(ob, metar_obs_text(&metar->obs[i], text, sizeof(text)));
+    }
+    outbuf_putc(ob, '"');
+  }
+  if (HAS(metar, METAR_F_OTHER)) {
+    outbuf_puts(ob, ",\"");
+    for (i = 0; i < metar->nstuff; i++) {
+      if (i) outbuf_putc(ob, ';');
+      csv_quoted(ob, metar->stuff[i]);
+    }
+    outbuf_putc(ob, '"');
+  }
+  outbuf_putc(ob, '\n');
+}
+
+
+/* PUBLIC--
+ * Format the report into a newly allocated string.
+ */
+char *metar_format(const metar_t *metar, int format) {
+  outbuf_t ob;
+
+  outbuf_init(&ob, NULL);
+  switch (format) {
+  case OUTPUT_BRIEF:
+  case OUTPUT_EXTRA:
+    shortdecode_Metar(&ob, metar, format == OUTPUT_EXTRA);
+    break;
+  case OUTPUT_FULL:
+    decode_Metar(&ob, metar);
+    break;
+  case OUTPUT_JSON:
+  case OUTPUT_NDJSON:
+    json_Metar(&ob, metar);
+    outbuf_putc(&ob, '\n');
+    break;
+  case OUTPUT_CSV:
+    csv_Metar(&ob, metar);
+    break;
+  default:
+    outbuf_free(&ob);
+    return NULL;
+  }
+  return ob.buf;
+} // metar_format
+
+
+/* PUBLIC--
+ * Free a string returned by metar_format().
+ */
+void metar_free(char *s) {
+  free(s);
+} // metar_free
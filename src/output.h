@@ -0,0 +1,95 @@
+/*
+  output.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* size of an output buffer, it is written out when full */
+#define OUTBUF_SIZE 65536
+
+/* machine-readable output formats */
+#define OUTPUT_JSON   1
+#define OUTPUT_NDJSON 2
+#define OUTPUT_CSV    3
+
+/* human-readable formats, for metar_format() */
+#define OUTPUT_BRIEF  4
+#define OUTPUT_EXTRA  5	// brief with extra information
+#define OUTPUT_FULL   6
+
+/* Output is collected in a buffer and written out in large chunks. A
+ * buffer without a stream grows as needed and the caller takes the text,
+ * which is always nul terminated. */
+typedef struct {
+  char   *buf;
+  size_t  len;
+  size_t  size;
+  FILE   *out;
+} outbuf_t;
+
+/* Set up a buffer writing to out, or growing if out is NULL. */
+void outbuf_init(outbuf_t *ob, FILE *out);
+
+/* Write out the buffered text. Returns 1 on a write error. */
+int outbuf_flush(outbuf_t *ob);
+
+/* Release the buffer, without writing it out. */
+void outbuf_free(outbuf_t *ob);
+
+/* append text */
+void outbuf_write(outbuf_t *ob, const char *s, size_t len);
+void outbuf_puts(outbuf_t *ob, const char *s);
+void outbuf_putc(outbuf_t *ob, char c);
+void outbuf_printf(outbuf_t *ob, const char *fmt, ...);
+
+/* Append an integer, zero padded to width digits. */
+void outbuf_int(outbuf_t *ob, long value, int width);
+
+/* Append a value with one decimal, rounded as printf("%.1f") does. */
+void outbuf_fixed1(outbuf_t *ob, float value);
+
+/* Append value / 10^decimals with that many decimals. */
+void outbuf_decimal(outbuf_t *ob, long value, int decimals);
+
+/* print the report decoded in full, one field per line, with the name of
+ * the station when it's in the directory */
+void decode_Metar(outbuf_t *ob, const metar_t *metar);
+
+/* print the report decoded briefly on a single line; extra adds the name
+ * of the station, pressure, visibility, clouds and other non-weather stuff */
+void shortdecode_Metar(outbuf_t *ob, const metar_t *metar, int extra);
+
+/* print the report as a JSON object, without a line break; the name and
+ * country of the station are included when it's in the directory */
+void json_Metar(outbuf_t *ob, const metar_t *metar);
+
+/* print the header line of CSV output with the columns of the METAR_F_*
+ * fields, and the records; the fields not decoded are left out of all the
+ * formats */
+void csv_header(outbuf_t *ob, unsigned int fields);
+void csv_Metar(outbuf_t *ob, const metar_t *metar);
+
+/* Format the report in one of the OUTPUT_* formats into a newly allocated
+ * string, for callers which don't want to deal with buffers. JSON and
+ * NDJSON give the object on a line, CSV the record without the header.
+ * Returns NULL for an unknown format. Free the string with metar_free().
+ */
+char *metar_format(const metar_t *metar, int format);
+
+/* Free a string returned by metar_format(). */
+void metar_free(char *s);
@@ -0,0 +1,239 @@
+/*
+  record.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metar.h"
+#include "record.h"
+
+/* the record layout is part of the file format */
+typedef char rec_size_check[sizeof(metar_rec_t) == 64 ? 1 : -1];
+
+/* unit names by REC_UNIT_* */
+static const char *units[] = {
+  "", "KT", "MPS", "m/s", "m", "SM", "hPa", "inHg"
+};
+
+/* cloud types by record type index */
+static const char *cloudtypes[] = {
+  "", "VV", "SKC", "FEW", "SCT", "BKN", "OVC"
+};
+
+/* stuff by REC_* flag bit */
+static const char *stuff[] = {
+  METAR_CAVOK, METAR_SNOCLO, METAR_NOSIG
+};
+
+#define NELEMS(a) (sizeof(a) / sizeof(a[0]))
+
+
+/* index of a name in a table, 0 if it isn't there */
+static int lookup(const char **table, int size, const char *name) {
+  int i;
+
+  for (i = 1; i < size; i++)
+    if (strcmp(table[i], name) == 0) return i;
+  return 0;
+}
+
+
+/* days from 1970-01-01 to a date of the Gregorian calendar */
+static long days_from_civil(long y, int m, int d) {
+  long era, yoe, doy;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+
+/* the value of n digits, -1 if they aren't all digits */
+static int digits(const char *s, int n) {
+  int v = 0;
+
+  for (; n > 0; n--, s++) {
+    if (*s < '0' || *s > '9') return -1;
+    v = v * 10 + *s - '0';
+  }
+  return v;
+}
+
+
+/* tenths of a value, rounded and clamped to the field */
+static uint16_t tenths(float value) {
+  float v = value * 10 + 0.5;
+  return (v < 0) ? 0 : (v > UINT16_MAX) ? UINT16_MAX : (uint16_t)v;
+}
+
+
+/* PUBLIC--
+ * Observation time of a report.
+ */
+time_t metar_obstime(const char *date, size_t datelen, const metar_t *metar,
+		     time_t now) {
+  char buf[36];
+  struct tm tm;
+  int y, mo, d, h, mi;
+
+  /* the NOAA date is always "YYYY/MM/DD HH:MM", which is converted
+     without sscanf() and timegm(), several times faster */
+  if (date && datelen == 16 && date[4] == '/' && date[7] == '/' &&
+      date[10] == ' ' && date[13] == ':' &&
+      (y = digits(date, 4)) >= 0 && (mo = digits(date + 5, 2)) >= 1 &&
+      mo <= 12 && (d = digits(date + 8, 2)) >= 1 && d <= 31 &&
+      (h = digits(date + 11, 2)) >= 0 && (mi = digits(date + 14, 2)) >= 0)
+    return days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60;
+
+  memset(&tm, 0x0, sizeof(tm));
+  if (date && datelen < sizeof(buf)) {
+    memcpy(buf, date, datelen);
+    buf[datelen] = 0;
+    if (sscanf(buf, "%d/%d/%d %d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+	       &tm.tm_hour, &tm.tm_min) == 5) {
+      tm.tm_year -= 1900;
+      tm.tm_mon -= 1;
+      return timegm(&tm);
+    }
+  }
+
+  gmtime_r(&now, &tm);
+  if (metar->day > tm.tm_mday) tm.tm_mon -= 1;
+  tm.tm_mday = metar->day;
+  tm.tm_hour = metar->time / 100;
+  tm.tm_min = metar->time % 100;
+  tm.tm_sec = 0;
+  return timegm(&tm);
+} // metar_obstime
+
+
+/* PUBLIC--
+ * Pack a decoded report into a record.
+ */
+void metar_pack(const metar_t *metar, time_t obstime, metar_rec_t *rec) {
+  const metar_obs_t *obs;
+  int i, j;
+
+  memset(rec, 0x0, sizeof(metar_rec_t));
+  memcpy(rec->station, metar->station, strnlen(metar->station, 4));
+  rec->obstime = obstime;
+  rec->day = metar->day;
+  rec->time = metar->time;
+
+  rec->winddir = metar->winddir;
+  rec->windstr = tenths(metar->windstr);
+  rec->windgust = tenths(metar->windgust);
+  rec->windunit = lookup(units, NELEMS(units), metar->windunit);
+
+  rec->vis = metar->vis;
+  rec->visunit = lookup(units, NELEMS(units), metar->visunit);
+
+  rec->qnh = metar->qnh;
+  rec->qnhunit = lookup(units, NELEMS(units), metar->qnhunit);
+  rec->qnhfp = metar->qnhfp;
+
+  rec->temp = metar->temp;
+  rec->dewp = metar->dewp;
+
+  for (i = 0; i < metar->nclouds && i < REC_MAXCLOUDS; i++) {
+    rec->clouds[i].type = lookup(cloudtypes, NELEMS(cloudtypes),
+				 metar->clouds[i].type);
+    rec->clouds[i].level = metar->clouds[i].level;
+  }
+  rec->nclouds = i;
+
+  for (i = 0; i < metar->nobs; i++) {
+    obs = &metar->obs[i];
+    if (rec->nwx + 1 + obs->ncodes > REC_WXSIZE) break;
+    rec->wx[rec->nwx++] = REC_WXGROUP + obs->intensity + 1;
+    for (j = 0; j < obs->ncodes; j++)
+      rec->wx[rec->nwx++] = obs->codes[j];
+  }
+
+  for (i = 0; i < metar->nstuff; i++)
+    for (j = 0; j < NELEMS(stuff); j++)
+      if (strcmp(metar->stuff[i], stuff[j]) == 0) rec->flags |= 1 << j;
+} // metar_pack
+
+
+/* PUBLIC--
+ * Unpack a record into a report.
+ */
+void metar_unpack(const metar_rec_t *rec, metar_t *metar) {
+  metar_obs_t *obs = NULL;
+  int i;
+
+  metar_reset(metar);
+  memcpy(metar->station, rec->station, 4);
+  metar->day = rec->day;
+  metar->time = rec->time;
+
+  metar->winddir = rec->winddir;
+  metar->windstr = rec->windstr / 10.0;
+  metar->windgust = rec->windgust / 10.0;
+  if (rec->windunit < NELEMS(units))
+    strcpy(metar->windunit, units[rec->windunit]);
+
+  metar->vis = rec->vis;
+  if (rec->visunit < NELEMS(units))
+    strcpy(metar->visunit, units[rec->visunit]);
+
+  metar->qnh = rec->qnh;
+  if (rec->qnhunit < NELEMS(units))
+    strcpy(metar->qnhunit, units[rec->qnhunit]);
+  metar->qnhfp = rec->qnhfp;
+
+  metar->temp = rec->temp;
+  metar->dewp = rec->dewp;
+
+  /* a record doesn't tell whether the temperature was reported, only the
+     units of the other fields do */
+  metar->found = METAR_F_STATION | METAR_F_TIME | METAR_F_TEMP;
+  if (rec->windunit != REC_UNIT_NONE) metar->found |= METAR_F_WIND;
+  if (rec->visunit != REC_UNIT_NONE || rec->vis == -1)
+    metar->found |= METAR_F_VIS;
+  if (rec->qnhunit != REC_UNIT_NONE) metar->found |= METAR_F_QNH;
+
+  for (i = 0; i < rec->nclouds && i < REC_MAXCLOUDS; i++) {
+    memset(&metar->clouds[i], 0x0, sizeof(cloud_t));
+    if (rec->clouds[i].type < NELEMS(cloudtypes))
+      strcpy(metar->clouds[i].type, cloudtypes[rec->clouds[i].type]);
+    metar->clouds[i].level = rec->clouds[i].level;
+  }
+  metar->nclouds = i;
+
+  for (i = 0; i < rec->nwx && i < REC_WXSIZE; i++) {
+    if (rec->wx[i] & REC_WXGROUP) {
+      if (metar->nobs == METAR_MAXOBS) break;
+      obs = &metar->obs[metar->nobs++];
+      memset(obs, 0x0, sizeof(metar_obs_t));
+      obs->intensity = (rec->wx[i] & ~REC_WXGROUP) - 1;
+    } else if (obs && obs->ncodes < METAR_MAXCODES) {
+      obs->codes[obs->ncodes++] = rec->wx[i];
+    }
+  }
+
+  for (i = 0; i < NELEMS(stuff); i++)
+    if (rec->flags & (1 << i)) metar->stuff[metar->nstuff++] = stuff[i];
+} // metar_unpack
@@ -0,0 +1,88 @@
+/*
+  record.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* capacities of a record */
+#define REC_MAXCLOUDS 4
+#define REC_WXSIZE    16
+
+/* units */
+#define REC_UNIT_NONE 0
+#define REC_UNIT_KT   1
+#define REC_UNIT_MPS  2	// MPS as reported
+#define REC_UNIT_MS   3	// m/s as converted from knots
+#define REC_UNIT_M    4
+#define REC_UNIT_SM   5
+#define REC_UNIT_HPA  6
+#define REC_UNIT_INHG 7
+
+/* flags for the other stuff reported */
+#define REC_CAVOK  0x01
+#define REC_SNOCLO 0x02
+#define REC_NOSIG  0x04
+
+/* weather groups in wx start with REC_WXGROUP + intensity + 1, followed by
+ * the code table indexes of the group */
+#define REC_WXGROUP 0x80
+
+/* A decoded report packed into 64 bytes, in host byte order. All fields
+ * are naturally aligned, so the records can be used directly from a
+ * memory-mapped file. */
+typedef struct {
+  char     station[4];	// ICAO code, not nul terminated
+  uint32_t obstime;	// observation time, seconds since the epoch
+  int32_t  vis;		// visibility, -1 more than 10 km
+  uint16_t time;	// HHMM UTC
+  int16_t  winddir;	// degrees, -1 variable
+  uint16_t windstr;	// tenths of windunit
+  uint16_t windgust;	// tenths of windunit
+  uint16_t qnh;		// in 10^-qnhfp qnhunit
+  uint8_t  day;
+  uint8_t  windunit;	// REC_UNIT_*
+  uint8_t  visunit;
+  uint8_t  qnhunit;
+  uint8_t  qnhfp;
+  int8_t   temp;
+  int8_t   dewp;
+  uint8_t  flags;	// REC_CAVOK etc.
+  uint8_t  nclouds;
+  uint8_t  nwx;		// bytes used in wx
+  struct {
+    uint8_t  type;	// index into the cloud types, 1 for VV
+    uint8_t  pad;
+    uint16_t level;	// hundreds of feet
+  } clouds[REC_MAXCLOUDS];
+  uint8_t  wx[REC_WXSIZE];
+} metar_rec_t;
+
+/* Observation time of a report: from the NOAA date "YYYY/MM/DD HH:MM" when
+ * given (date may be NULL), otherwise from the day and time of the report
+ * in the month of now, or the month before if the day is still ahead.
+ */
+time_t metar_obstime(const char *date, size_t datelen, const metar_t *metar,
+		     time_t now);
+
+/* Pack a decoded report observed at obstime into a record. Cloud layers
+ * and weather groups which don't fit are dropped.
+ */
+void metar_pack(const metar_t *metar, time_t obstime, metar_rec_t *rec);
+
+/* Unpack a record into a report for printing. */
+void metar_unpack(const metar_rec_t *rec, metar_t *metar);
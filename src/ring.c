@@ -0,0 +1,157 @@
+/*
+  ring.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metar.h"
+#include "output.h"
+#include "stats.h"
+#include "ring.h"
+
+
+/* PUBLIC--
+ * Set up a queue with size slots, rounded up to a power of two.
+ */
+int ring_init(ring_t *ring, size_t size) {
+  memset(ring, 0x0, sizeof(ring_t));
+  for (ring->size = 1; ring->size < size; ring->size *= 2);
+  if ((ring->slots = calloc(ring->size, sizeof(void *))) == NULL) return 1;
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->cond, NULL);
+  return 0;
+} // ring_init
+
+
+/* PUBLIC--
+ * Release the queue.
+ */
+void ring_free(ring_t *ring) {
+  pthread_cond_destroy(&ring->cond);
+  pthread_mutex_destroy(&ring->lock);
+  free(ring->slots);
+  ring->slots = NULL;
+} // ring_free
+
+
+/* Wake the other end if it's waiting. An end about to wait announces it
+ * before looking at the queue once more, and the positions are stored
+ * before this looks, so one of them sees the other. */
+static void ring_wake(ring_t *ring) {
+  if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) == 0) return;
+  pthread_mutex_lock(&ring->lock);
+  pthread_cond_broadcast(&ring->cond);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+
+/* PUBLIC--
+ * Add an item, waiting for room if the queue is full.
+ */
+void ring_push(ring_t *ring, void *item) {
+  ring_end_t *head = &ring->head;
+  uint64_t tail = __atomic_load_n(&ring->tail.pos, __ATOMIC_ACQUIRE);
+
+  if (head->pos - tail == ring->size) {
+    head->stalls++;
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    while (head->pos - (tail = __atomic_load_n(&ring->tail.pos,
+					       __ATOMIC_SEQ_CST))
+	   == ring->size)
+      pthread_cond_wait(&ring->cond, &ring->lock);
+    __atomic_sub_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+  }
+
+  ring->slots[head->pos & (ring->size - 1)] = item;
+  __atomic_store_n(&head->pos, head->pos + 1, __ATOMIC_SEQ_CST);
+  if (head->pos - tail > head->maxdepth) head->maxdepth = head->pos - tail;
+  ring_wake(ring);
+} // ring_push
+
+
+/* PUBLIC--
+ * Take the oldest item, NULL if there is none right now.
+ */
+void *ring_trypop(ring_t *ring) {
+  ring_end_t *tail = &ring->tail;
+  void *item;
+
+  if (__atomic_load_n(&ring->head.pos, __ATOMIC_ACQUIRE) == tail->pos)
+    return NULL;
+  item = ring->slots[tail->pos & (ring->size - 1)];
+  __atomic_store_n(&tail->pos, tail->pos + 1, __ATOMIC_SEQ_CST);
+  ring_wake(ring);
+  return item;
+} // ring_trypop
+
+
+/* PUBLIC--
+ * Take the oldest item, waiting for one; NULL once the queue is closed
+ * and empty.
+ */
+void *ring_pop(ring_t *ring) {
+  ring_end_t *tail = &ring->tail;
+  void *item;
+
+  while ((item = ring_trypop(ring)) == NULL) {
+    /* the items pushed before closing are there by now */
+    if (__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST))
+      return ring_trypop(ring);
+
+    tail->stalls++;
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&ring->head.pos, __ATOMIC_SEQ_CST) == tail->pos &&
+	   !__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST))
+      pthread_cond_wait(&ring->cond, &ring->lock);
+    __atomic_sub_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+  }
+  return item;
+} // ring_pop
+
+
+/* PUBLIC--
+ * Tell the consumer that no more items are coming.
+ */
+void ring_close(ring_t *ring) {
+  pthread_mutex_lock(&ring->lock);
+  __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&ring->cond);
+  pthread_mutex_unlock(&ring->lock);
+} // ring_close
+
+
+/* PUBLIC--
+ * The use of the queue so far.
+ */
+void ring_stats(const ring_t *ring, queue_stats_t *qs) {
+  qs->capacity = ring->size;
+  qs->items = ring->head.pos;
+  qs->full = ring->head.stalls;
+  qs->empty = ring->tail.stalls;
+  qs->maxdepth = ring->head.maxdepth;
+} // ring_stats
+
+// EOF
@@ -0,0 +1,76 @@
+/*
+  ring.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Bounded queue of pointers from one producer thread to one consumer
+ * thread. The two ends are on cache lines of their own and passing an
+ * item takes no locks, only an atomic store of the position. A push to a
+ * full queue waits for room, which holds the producer back to the pace of
+ * the consumer, and a pop from an empty one waits for an item; only then
+ * are the lock and condition used. Each end counts its waits, for tuning
+ * the depth.
+ *
+ * Needs <pthread.h>, <stdint.h> and stats.h.
+ */
+
+/* default number of slots of the queues between the stages of the fetch
+ * pipeline */
+#define RING_SIZE 64
+
+/* one end of the queue, written by its own thread only */
+typedef struct {
+  uint64_t pos;		// items pushed or popped
+  uint64_t stalls;	// waits for room or for an item
+  uint64_t maxdepth;	// most items queued, seen by the producer
+  char     pad[64 - 3 * sizeof(uint64_t)];
+} ring_end_t;
+
+typedef struct {
+  ring_end_t      head;		// producer
+  ring_end_t      tail;		// consumer
+  void          **slots;
+  size_t          size;		// a power of two
+  int             closed;
+  int             waiting;	// ends waiting on the condition
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} ring_t;
+
+/* Set up a queue of at least size slots, returns 1 if out of memory. */
+int ring_init(ring_t *ring, size_t size);
+
+/* Release the queue, which must not be used by either end any more. */
+void ring_free(ring_t *ring);
+
+/* Add an item, waiting for room if the queue is full. */
+void ring_push(ring_t *ring, void *item);
+
+/* Take the oldest item, waiting for one if the queue is empty. Returns
+ * NULL once the queue is closed and empty. */
+void *ring_pop(ring_t *ring);
+
+/* Take the oldest item, NULL if there is none right now. */
+void *ring_trypop(ring_t *ring);
+
+/* Tell the consumer that no more items are coming. */
+void ring_close(ring_t *ring);
+
+/* The use of the queue so far, once both ends are done with it. */
+void ring_stats(const ring_t *ring, queue_stats_t *qs);
@@ -0,0 +1,133 @@
+/*
+  schedule.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "station.h"
+#include "schedule.h"
+
+
+/* is the minute one the station reports at: seen about twice at least,
+ * and at least a quarter as often as its most common minute, which leaves
+ * out special reports scattered between the routine ones */
+static int routine_minute(const sched_t *sched, int minute, int most) {
+  int weight = sched->minutes[minute];
+
+  return weight >= SCHED_WEIGHT * 3 / 2 && weight * 4 >= most;
+}
+
+
+/* PUBLIC--
+ * Set up the schedule of a station.
+ */
+void sched_init(sched_t *sched, const char *station, time_t now) {
+  memset(sched, 0x0, sizeof(sched_t));
+  sched->next = now;
+  sched->lag = SCHED_LAG;
+  sched->offset = station_hash(STATION_KEY(station), 0) % SCHED_SPREAD;
+} // sched_init
+
+
+/* PUBLIC--
+ * Learn from a report of the station.
+ */
+void sched_report(sched_t *sched, time_t obs, time_t now) {
+  time_t from;
+  int minute, weight, lag, i;
+
+  if (obs <= sched->obs) return;
+
+  /* the report was published after the previous poll, or after it was
+     observed if that is later, and before now; take the middle. The first
+     report says nothing, it may have been out for long */
+  if (sched->polled && sched->obs) {
+    from = (sched->polled > obs) ? sched->polled : obs;
+    lag = (from + now) / 2 - obs;
+    if (lag >= 0 && lag <= SCHED_MAXLAG)
+      sched->lag += (lag - sched->lag) / 4;
+  }
+
+  for (i = 0; i < 60; i++)
+    sched->minutes[i] -= sched->minutes[i] >> 4;
+  minute = (obs / 60) % 60;
+  weight = sched->minutes[minute] + SCHED_WEIGHT;
+  sched->minutes[minute] = (weight > UINT8_MAX) ? UINT8_MAX : weight;
+
+  sched->obs = obs;
+  sched->reports++;
+  sched->fresh = 1;
+} // sched_report
+
+
+/* PUBLIC--
+ * When the report following the latest one is expected to be published.
+ */
+time_t sched_expect(const sched_t *sched) {
+  time_t t;
+  int most = 0, i;
+
+  if (sched->reports < SCHED_LEARN) return 0;
+  for (i = 0; i < 60; i++)
+    if (sched->minutes[i] > most) most = sched->minutes[i];
+
+  /* the first routine minute after the latest observation */
+  t = sched->obs - sched->obs % 60;
+  for (i = 0; i < 60; i++) {
+    t += 60;
+    if (routine_minute(sched, (t / 60) % 60, most)) return t + sched->lag;
+  }
+  return 0;
+} // sched_expect
+
+
+/* PUBLIC--
+ * Schedule the next poll of a station.
+ */
+void sched_polled(sched_t *sched, time_t now, int interval) {
+  time_t expect, next;
+  int misses;
+
+  if (sched->fresh) sched->misses = 0;
+  else sched->misses++;
+  sched->fresh = 0;
+  sched->polled = now;
+
+  if (!(expect = sched_expect(sched))) {
+    sched->next = now + interval;
+    return;
+  }
+
+  next = now + SCHED_MAXGAP;
+  if (expect + sched->offset > now) {
+    /* poll shortly after the next report is expected */
+    if (expect + sched->offset < next) next = expect + sched->offset;
+  } else {
+    /* overdue: retry soon, then less and less often */
+    misses = (sched->misses < 6) ? sched->misses : 6;
+    if (misses > 0) misses--;
+    if (now + (SCHED_RETRY << misses) < next)
+      next = now + (SCHED_RETRY << misses);
+  }
+  sched->next = next;
+} // sched_polled
+
+// EOF
@@ -0,0 +1,83 @@
+/*
+  schedule.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Poll scheduling of the daemon. Stations issue their routine reports at
+ * fixed minutes past the hour, and NOAA publishes them a few minutes
+ * later. The scheduler learns those minutes from the observation times
+ * of the reports received and the delay until publication from when they
+ * turned up, polls a station shortly after its next report is expected,
+ * and backs off while nothing new turns up. Each station is polled with
+ * an offset of its own so that stations reporting at the same minutes
+ * don't all hit the server at once. Until a station's minutes are known
+ * it is polled at a fixed interval.
+ *
+ * Needs <stdint.h> and <time.h>.
+ */
+
+/* reports needed before the minutes of a station are trusted */
+#define SCHED_LEARN 4
+
+/* weight a report adds to its minute; the weights of all minutes decay
+ * by 1/16 with each report, so a changed pattern is picked up in time */
+#define SCHED_WEIGHT 16
+
+/* longest time between polls of a learnt station, so that special
+ * reports (SPECI) and changes of the pattern are noticed */
+#define SCHED_MAXGAP 1800
+
+/* first retry after a poll which brought nothing new, doubled with each
+ * further one */
+#define SCHED_RETRY 60
+
+/* the offsets of the stations are spread over this many seconds */
+#define SCHED_SPREAD 90
+
+/* delay from observation to publication assumed before one is measured,
+ * and the most a delay is believed to be */
+#define SCHED_LAG 300
+#define SCHED_MAXLAG 3600
+
+typedef struct {
+  time_t   next;	// when to poll next
+  time_t   polled;	// when last polled, 0 if never
+  time_t   obs;		// observation time of the latest report
+  int      lag;		// seconds from observation to publication
+  int      misses;	// polls since the latest report turned up
+  int      offset;	// seconds added to the expected publication
+  int      reports;	// reports learnt from
+  int      fresh;	// a new report turned up in this poll
+  uint8_t  minutes[60];	// weight of each minute past the hour
+} sched_t;
+
+/* Set up the schedule of a station, due to be polled at now. */
+void sched_init(sched_t *sched, const char *station, time_t now);
+
+/* Learn from a report of the station observed at obs received at now.
+ * Reports not newer than the latest one are ignored. */
+void sched_report(sched_t *sched, time_t obs, time_t now);
+
+/* A poll of the station finished at now; schedule the next one. interval
+ * is the time between polls until the station's minutes are learnt. */
+void sched_polled(sched_t *sched, time_t now, int interval);
+
+/* The time the report following the latest one is expected to be
+ * published, or 0 if the minutes of the station aren't learnt yet. */
+time_t sched_expect(const sched_t *sched);
@@ -0,0 +1,78 @@
+/*
+  station.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <string.h>
+#include "station.h"
+#include "stationtab.h"
+
+
+/* PUBLIC--
+ * Is the string a well-formed ICAO code.
+ */
+int station_valid(const char *icao) {
+  int i;
+
+  if (!isalpha((unsigned char)icao[0])) return 0;
+  for (i = 1; i < 4; i++)
+    if (!isalnum((unsigned char)icao[i])) return 0;
+  return icao[4] == 0;
+} // station_valid
+
+
+/* PUBLIC--
+ * Look up a station by its code.
+ */
+const station_t *station_lookup(const char *icao) {
+  char code[4];
+  uint32_t key, slot;
+  int i;
+
+  if (!station_valid(icao)) return NULL;
+  for (i = 0; i < 4; i++) code[i] = toupper((unsigned char)icao[i]);
+  key = STATION_KEY(code);
+
+  slot = station_hash(key, station_seeds[station_hash(key, 0) &
+					 (STATION_NBUCKETS - 1)]);
+  i = station_slots[slot & (STATION_NSLOTS - 1)];
+  if (i == 0 || stations[i - 1].key != key) return NULL;
+  return &stations[i - 1];
+} // station_lookup
+
+
+/* PUBLIC--
+ * Number of stations in the directory.
+ */
+int station_count(void) {
+  return sizeof(stations) / sizeof(stations[0]);
+} // station_count
+
+
+/* PUBLIC--
+ * The i'th station of the directory, in the order of the codes.
+ */
+const station_t *station_get(int i) {
+  if (i < 0 || i >= station_count()) return NULL;
+  return &stations[i];
+} // station_get
+
+// EOF
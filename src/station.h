@@ -0,0 +1,69 @@
+/*
+  station.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Station directory: name, country, position and elevation by the ICAO
+ * code. The table is generated from data/stations.txt by tools/mkstations
+ * into a perfect hash, so a lookup takes a couple of hashes and one
+ * comparison and nothing is read at startup.
+ *
+ * Needs <stdint.h>.
+ */
+
+/* ICAO code packed into 32 bits, first letter in the high byte */
+#define STATION_KEY(s) \
+  ((uint32_t)(unsigned char)(s)[0] << 24 | \
+   (uint32_t)(unsigned char)(s)[1] << 16 | \
+   (uint32_t)(unsigned char)(s)[2] << 8 | (uint32_t)(unsigned char)(s)[3])
+
+typedef struct {
+  uint32_t    key;	// STATION_KEY() of icao
+  char        icao[5];
+  int16_t     elevation;	// metres
+  float       lat;	// degrees, north positive
+  float       lon;	// degrees, east positive
+  const char *name;
+  const char *country;
+} station_t;
+
+/* Hash of a key; the bucket of a key is its hash with seed 0 and its slot
+ * the hash with the seed stored for the bucket. Shared with mkstations.
+ */
+static inline uint32_t station_hash(uint32_t key, uint32_t seed) {
+  key ^= seed * 0x9e3779b9u;
+  key ^= key >> 16;
+  key *= 0x85ebca6bu;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35u;
+  key ^= key >> 16;
+  return key;
+}
+
+/* Is the string a well-formed ICAO code, four letters or digits starting
+ * with a letter. Lower case is accepted.
+ */
+int station_valid(const char *icao);
+
+/* Look up a station by its code, NULL if it's not in the directory. */
+const station_t *station_lookup(const char *icao);
+
+/* number of stations in the directory, and the i'th of them */
+int station_count(void);
+const station_t *station_get(int i);
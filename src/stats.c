@@ -0,0 +1,455 @@
+/*
+  stats.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metar.h"
+#include "output.h"
+#include "station.h"
+#include "stats.h"
+
+/* fetch times of a station */
+typedef struct {
+  char        station[10];
+  histogram_t fetch;
+} station_stats_t;
+
+/* the stage times and counters of a thread, added up when printed; only
+ * the owner writes them and everything is loaded and stored atomically,
+ * so the hooks don't lock. A thread which exits leaves its totals to the
+ * next one started. */
+typedef struct shard {
+  histogram_t   stages[STAT_NSTAGES];
+  uint64_t      counters[STAT_NCOUNTERS];
+  int           owned;
+  struct shard *next;
+} shard_t;
+
+int stats_enabled = 0;
+
+static const char *stage_names[STAT_NSTAGES] = {
+  "dns", "connect", "tls", "wait", "transfer", "fetch", "split", "parse",
+  "output"
+};
+
+static const char *queue_names[STAT_NQUEUES] = { "decode", "output" };
+
+/* statslock covers the list of shards, the stations and the queues */
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
+static shard_t *shards;
+static pthread_key_t shardkey;
+static pthread_once_t shardonce = PTHREAD_ONCE_INIT;
+static queue_stats_t queues[STAT_NQUEUES];
+static uint64_t started;
+
+/* open addressed table of the stations, a power of two in size */
+static station_stats_t *stations;
+static size_t nstations, tablesize;
+
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* the bucket of a time: the highest bit picks four buckets, the two bits
+ * below it one of them */
+static int bucket_of(uint64_t ns) {
+  int msb, i;
+
+  if (ns < 4) return ns;
+  msb = 63 - __builtin_clzll(ns);
+  i = (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+  return i < STATS_NBUCKETS ? i : STATS_NBUCKETS - 1;
+}
+
+
+/* the smallest time of a bucket */
+static double bucket_start(int i) {
+  if (i < 4) return i;
+  return (double)((uint64_t)(4 + i % 4) << (i / 4 - 1));
+}
+
+
+/* PUBLIC--
+ * Add a time in ns to a histogram.
+ */
+void histogram_add(histogram_t *h, uint64_t ns) {
+  h->buckets[bucket_of(ns)]++;
+  if (h->count == 0 || ns < h->min) h->min = ns;
+  if (ns > h->max) h->max = ns;
+  h->count++;
+  h->sum += ns;
+} // histogram_add
+
+
+static inline uint64_t load(const uint64_t *v) {
+  return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+
+/* add to a value of the thread's own shard */
+static inline void bump(uint64_t *v, uint64_t n) {
+  __atomic_store_n(v, load(v) + n, __ATOMIC_RELAXED);
+}
+
+
+/* histogram_add() on a shard, which may be read meanwhile */
+static void shard_add(histogram_t *h, uint64_t ns) {
+  if (load(&h->count) == 0 || ns < load(&h->min))
+    __atomic_store_n(&h->min, ns, __ATOMIC_RELAXED);
+  if (ns > load(&h->max)) __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+  bump(&h->buckets[bucket_of(ns)], 1);
+  bump(&h->sum, ns);
+  bump(&h->count, 1);
+}
+
+
+/* add a shard's histogram to the totals */
+static void merge_histogram(histogram_t *to, const histogram_t *h) {
+  uint64_t count = load(&h->count);
+  int i;
+
+  if (count == 0) return;
+  if (to->count == 0 || load(&h->min) < to->min) to->min = load(&h->min);
+  if (load(&h->max) > to->max) to->max = load(&h->max);
+  to->count += count;
+  to->sum += load(&h->sum);
+  for (i = 0; i < STATS_NBUCKETS; i++)
+    to->buckets[i] += load(&h->buckets[i]);
+}
+
+
+static void release_shard(void *arg) {
+  shard_t *shard = arg;
+
+  __atomic_store_n(&shard->owned, 0, __ATOMIC_RELEASE);
+}
+
+
+static void init_shards(void) {
+  pthread_key_create(&shardkey, release_shard);
+}
+
+
+/* the shard of the calling thread, taken over from a thread gone or added
+ * on its first use; NULL if out of memory */
+static shard_t *thread_shard(void) {
+  shard_t *shard;
+
+  pthread_once(&shardonce, init_shards);
+  if ((shard = pthread_getspecific(shardkey)) != NULL) return shard;
+
+  pthread_mutex_lock(&statslock);
+  for (shard = shards; shard; shard = shard->next)
+    if (!__atomic_load_n(&shard->owned, __ATOMIC_ACQUIRE)) break;
+  if (shard == NULL && (shard = calloc(1, sizeof(shard_t))) != NULL) {
+    shard->next = shards;
+    shards = shard;
+  }
+  if (shard) __atomic_store_n(&shard->owned, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&statslock);
+
+  if (shard) pthread_setspecific(shardkey, shard);
+  return shard;
+}
+
+
+/* the slot of the station in the table, NULL if it is full */
+static station_stats_t *find_station(station_stats_t *table, size_t size,
+				     const char *station) {
+  size_t i = station_hash(STATION_KEY(station), 0) & (size - 1), n;
+
+  for (n = 0; n < size; n++, i = (i + 1) & (size - 1))
+    if (table[i].station[0] == 0 || strcmp(table[i].station, station) == 0)
+      return &table[i];
+  return NULL;
+}
+
+
+/* the entry of the station, added if needed */
+static station_stats_t *station_entry(const char *station) {
+  station_stats_t *table, *entry;
+  size_t size, i;
+
+  /* keep the table at most half full */
+  if (2 * (nstations + 1) > tablesize) {
+    size = tablesize ? tablesize * 2 : 64;
+    if ((table = calloc(size, sizeof(station_stats_t))) == NULL) return NULL;
+    for (i = 0; i < tablesize; i++)
+      if (stations[i].station[0])
+	*find_station(table, size, stations[i].station) = stations[i];
+    free(stations);
+    stations = table;
+    tablesize = size;
+  }
+
+  entry = find_station(stations, tablesize, station);
+  if (entry->station[0] == 0) {
+    strncpy(entry->station, station, sizeof(entry->station) - 1);
+    nstations++;
+  }
+  return entry;
+}
+
+
+/* PUBLIC--
+ * Start measuring.
+ */
+void stats_init(void) {
+  started = monotonic_ns();
+  stats_enabled = 1;
+} // stats_init
+
+
+/* PUBLIC--
+ * Monotonic time in ns, or 0 when not measuring.
+ */
+uint64_t stats_start(void) {
+  return stats_enabled ? monotonic_ns() : 0;
+} // stats_start
+
+
+/* PUBLIC--
+ * Add the time since start to the stage.
+ */
+void stats_stop(int stage, uint64_t start) {
+  if (stats_enabled) stats_add(stage, monotonic_ns() - start);
+} // stats_stop
+
+
+/* PUBLIC--
+ * Add a time in ns to the stage.
+ */
+void stats_add(int stage, uint64_t ns) {
+  shard_t *shard;
+
+  if (stats_enabled && (shard = thread_shard()) != NULL)
+    shard_add(&shard->stages[stage], ns);
+} // stats_add
+
+
+/* PUBLIC--
+ * Add a fetch time in ns to the station and to STAT_FETCH.
+ */
+void stats_station(const char *station, uint64_t ns) {
+  station_stats_t *entry;
+
+  if (!stats_enabled) return;
+  stats_add(STAT_FETCH, ns);
+  pthread_mutex_lock(&statslock);
+  if ((entry = station_entry(station)) != NULL)
+    histogram_add(&entry->fetch, ns);
+  pthread_mutex_unlock(&statslock);
+} // stats_station
+
+
+/* PUBLIC--
+ * Add n to the counter.
+ */
+void stats_count(int counter, uint64_t n) {
+  shard_t *shard;
+
+  if (stats_enabled && (shard = thread_shard()) != NULL)
+    bump(&shard->counters[counter], n);
+} // stats_count
+
+
+/* PUBLIC--
+ * Add the use of a queue to its totals; the capacity and depth are the
+ * largest seen.
+ */
+void stats_queue(int queue, const queue_stats_t *qs) {
+  queue_stats_t *q = &queues[queue];
+
+  if (!stats_enabled) return;
+  pthread_mutex_lock(&statslock);
+  if (qs->capacity > q->capacity) q->capacity = qs->capacity;
+  if (qs->maxdepth > q->maxdepth) q->maxdepth = qs->maxdepth;
+  q->items += qs->items;
+  q->full += qs->full;
+  q->empty += qs->empty;
+  pthread_mutex_unlock(&statslock);
+} // stats_queue
+
+
+/* one line of each queue used */
+static void queue_metric(outbuf_t *ob, const char *name, const char *help,
+			 const char *type, size_t offset) {
+  const uint64_t *value;
+  int i;
+
+  outbuf_printf(ob, "# HELP %s %s\n", name, help);
+  outbuf_printf(ob, "# TYPE %s %s\n", name, type);
+  for (i = 0; i < STAT_NQUEUES; i++) {
+    if (queues[i].capacity == 0) continue;
+    value = (const uint64_t *)((const char *)&queues[i] + offset);
+    outbuf_printf(ob, "%s{queue=\"%s\"} %llu\n", name, queue_names[i],
+		  (unsigned long long)*value);
+  }
+}
+
+
+/* PUBLIC--
+ * Estimate a quantile of the histogram, interpolating within the bucket
+ * it falls in and keeping within the smallest and largest time seen.
+ */
+double histogram_quantile(const histogram_t *h, double q) {
+  double rank, lo, hi, value;
+  uint64_t below = 0;
+  int i;
+
+  if (h->count == 0) return 0;
+  rank = q * h->count;
+  for (i = 0; i < STATS_NBUCKETS - 1; i++) {
+    if (below + h->buckets[i] >= rank) break;
+    below += h->buckets[i];
+  }
+  lo = bucket_start(i);
+  hi = bucket_start(i + 1);
+  value = h->buckets[i] ? lo + (hi - lo) * (rank - below) / h->buckets[i] : lo;
+  if (value < h->min) value = h->min;
+  if (value > h->max) value = h->max;
+  return value;
+} // histogram_quantile
+
+
+/* a summary, labels are the labels of all its lines */
+static void summary(outbuf_t *ob, const char *name, const char *labels,
+		    const histogram_t *h) {
+  static const double quantiles[] = { 0.5, 0.9, 0.99 };
+  size_t i;
+
+  for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    outbuf_printf(ob, "%s{%s,quantile=\"%g\"} %.9f\n", name, labels,
+		  quantiles[i], histogram_quantile(h, quantiles[i]) / 1e9);
+  outbuf_printf(ob, "%s_sum{%s} %.9f\n", name, labels, h->sum / 1e9);
+  outbuf_printf(ob, "%s_count{%s} %llu\n", name, labels,
+		(unsigned long long)h->count);
+}
+
+
+static int compare_stations(const void *a, const void *b) {
+  return strcmp(((const station_stats_t *)a)->station,
+		((const station_stats_t *)b)->station);
+}
+
+
+/* PUBLIC--
+ * Append the statistics in the Prometheus text format.
+ */
+void stats_prometheus(outbuf_t *ob) {
+  histogram_t stages[STAT_NSTAGES];
+  uint64_t counters[STAT_NCOUNTERS];
+  station_stats_t *sorted;
+  const shard_t *shard;
+  char labels[64];
+  double uptime;
+  size_t i, n;
+
+  memset(stages, 0x0, sizeof(stages));
+  memset(counters, 0x0, sizeof(counters));
+  pthread_mutex_lock(&statslock);
+  uptime = (monotonic_ns() - started) / 1e9;
+  for (shard = shards; shard; shard = shard->next) {
+    for (i = 0; i < STAT_NSTAGES; i++)
+      merge_histogram(&stages[i], &shard->stages[i]);
+    for (i = 0; i < STAT_NCOUNTERS; i++)
+      counters[i] += load(&shard->counters[i]);
+  }
+
+  outbuf_puts(ob, "# HELP metar_stage_seconds Time spent in each stage.\n");
+  outbuf_puts(ob, "# TYPE metar_stage_seconds summary\n");
+  for (i = 0; i < STAT_NSTAGES; i++) {
+    if (stages[i].count == 0) continue;
+    snprintf(labels, sizeof(labels), "stage=\"%s\"", stage_names[i]);
+    summary(ob, "metar_stage_seconds", labels, &stages[i]);
+  }
+
+  /* the stations in order, for a stable output */
+  sorted = malloc((nstations ? nstations : 1) * sizeof(station_stats_t));
+  for (i = n = 0; sorted && i < tablesize; i++)
+    if (stations[i].station[0]) sorted[n++] = stations[i];
+  qsort(sorted, n, sizeof(station_stats_t), compare_stations);
+  outbuf_puts(ob, "# HELP metar_station_fetch_seconds "
+	      "Time to fetch the NOAA data of each station.\n");
+  outbuf_puts(ob, "# TYPE metar_station_fetch_seconds summary\n");
+  for (i = 0; i < n; i++) {
+    snprintf(labels, sizeof(labels), "station=\"%s\"", sorted[i].station);
+    summary(ob, "metar_station_fetch_seconds", labels, &sorted[i].fetch);
+  }
+  free(sorted);
+
+  outbuf_puts(ob, "# HELP metar_reports_total Reports handled.\n");
+  outbuf_puts(ob, "# TYPE metar_reports_total counter\n");
+  outbuf_printf(ob, "metar_reports_total %llu\n",
+		(unsigned long long)counters[STAT_REPORTS]);
+  outbuf_puts(ob, "# HELP metar_fetch_failures_total Failed fetches.\n");
+  outbuf_puts(ob, "# TYPE metar_fetch_failures_total counter\n");
+  outbuf_printf(ob, "metar_fetch_failures_total %llu\n",
+		(unsigned long long)counters[STAT_FAILURES]);
+  outbuf_puts(ob, "# HELP metar_fetch_bytes_total Bytes of NOAA data "
+	      "fetched.\n");
+  outbuf_puts(ob, "# TYPE metar_fetch_bytes_total counter\n");
+  outbuf_printf(ob, "metar_fetch_bytes_total %llu\n",
+		(unsigned long long)counters[STAT_BYTES]);
+  outbuf_puts(ob, "# HELP metar_polls_total Stations polled by the "
+	      "daemon.\n");
+  outbuf_puts(ob, "# TYPE metar_polls_total counter\n");
+  outbuf_printf(ob, "metar_polls_total %llu\n",
+		(unsigned long long)counters[STAT_POLLS]);
+  outbuf_puts(ob, "# HELP metar_polls_unchanged_total Polls which brought "
+	      "no new report.\n");
+  outbuf_puts(ob, "# TYPE metar_polls_unchanged_total counter\n");
+  outbuf_printf(ob, "metar_polls_unchanged_total %llu\n",
+		(unsigned long long)counters[STAT_UNCHANGED]);
+  for (i = 0; i < STAT_NQUEUES && queues[i].capacity == 0; i++);
+  if (i < STAT_NQUEUES) {
+    queue_metric(ob, "metar_queue_capacity", "Slots of each queue.",
+		 "gauge", offsetof(queue_stats_t, capacity));
+    queue_metric(ob, "metar_queue_depth_max", "Most items queued at once.",
+		 "gauge", offsetof(queue_stats_t, maxdepth));
+    queue_metric(ob, "metar_queue_items_total", "Items passed through "
+		 "each queue.", "counter", offsetof(queue_stats_t, items));
+    queue_metric(ob, "metar_queue_full_stalls_total", "Pushes which waited "
+		 "for room.", "counter", offsetof(queue_stats_t, full));
+    queue_metric(ob, "metar_queue_empty_stalls_total", "Pops which waited "
+		 "for an item.", "counter", offsetof(queue_stats_t, empty));
+  }
+  outbuf_puts(ob, "# HELP metar_reports_per_second Reports handled per "
+	      "second since the start.\n");
+  outbuf_puts(ob, "# TYPE metar_reports_per_second gauge\n");
+  outbuf_printf(ob, "metar_reports_per_second %.3f\n",
+		uptime > 0 ? counters[STAT_REPORTS] / uptime : 0);
+  outbuf_puts(ob, "# HELP metar_uptime_seconds Seconds since the start.\n");
+  outbuf_puts(ob, "# TYPE metar_uptime_seconds gauge\n");
+  outbuf_printf(ob, "metar_uptime_seconds %.3f\n", uptime);
+  pthread_mutex_unlock(&statslock);
+} // stats_prometheus
+
+// EOF
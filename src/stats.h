@@ -0,0 +1,117 @@
+/*
+  stats.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Time spent in each stage of fetching, splitting, parsing and printing
+ * reports, kept in histograms of nanoseconds, and the fetch time of
+ * each station. Nothing is measured until stats_init() is called, so the
+ * hooks cost a test of stats_enabled otherwise. Each thread adds its
+ * stage times and counters up on its own, without locking, and they are
+ * merged when printed; the fetch times of the stations and the queues are
+ * locked.
+ *
+ * Needs <stdint.h> and output.h.
+ */
+
+/* histogram buckets; each power of two of ns is split into four buckets,
+ * so a quantile is off by less than 1/8 of it, up to 2^40 ns */
+#define STATS_NBUCKETS 160
+
+/* stages */
+enum {
+  STAT_DNS,		// name lookup
+  STAT_CONNECT,		// TCP connect
+  STAT_TLS,		// TLS handshake
+  STAT_WAIT,		// request sent until the first byte
+  STAT_TRANSFER,	// first byte until the last
+  STAT_FETCH,		// whole fetch of a station
+  STAT_SPLIT,		// splitting NOAA data into records
+  STAT_PARSE,		// parse_Metar_n()
+  STAT_OUTPUT,		// formatting a report
+  STAT_NSTAGES
+};
+
+/* counters */
+enum {
+  STAT_REPORTS,		// reports handled
+  STAT_FAILURES,	// failed fetches
+  STAT_BYTES,		// bytes fetched
+  STAT_POLLS,		// stations polled by the daemon
+  STAT_UNCHANGED,	// polls which brought no new report
+  STAT_NCOUNTERS
+};
+
+/* queues between the stages of the fetch pipeline */
+enum {
+  STAT_QDECODE,		// fetched reports waiting to be decoded
+  STAT_QOUTPUT,		// formatted reports waiting to be written
+  STAT_NQUEUES
+};
+
+/* the use of a queue */
+typedef struct {
+  uint64_t capacity;
+  uint64_t items;	// items passed through
+  uint64_t full;	// pushes which waited for room
+  uint64_t empty;	// pops which waited for an item
+  uint64_t maxdepth;	// most items queued at once
+} queue_stats_t;
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;		// ns
+  uint64_t min, max;
+  uint64_t buckets[STATS_NBUCKETS];
+} histogram_t;
+
+extern int stats_enabled;
+
+/* Start measuring; the report rate is counted from here. */
+void stats_init(void);
+
+/* Monotonic time in ns, or 0 when not measuring. */
+uint64_t stats_start(void);
+
+/* Add the time since start, a stats_start() value, to the stage. */
+void stats_stop(int stage, uint64_t start);
+
+/* Add a time in ns to the stage. */
+void stats_add(int stage, uint64_t ns);
+
+/* Add a fetch time in ns to the station, and to STAT_FETCH. */
+void stats_station(const char *station, uint64_t ns);
+
+/* Add n to the counter. */
+void stats_count(int counter, uint64_t n);
+
+/* Add the use of a queue to its totals. */
+void stats_queue(int queue, const queue_stats_t *qs);
+
+/* Add a time in ns to a histogram of the caller, without locking. */
+void histogram_add(histogram_t *h, uint64_t ns);
+
+/* Estimate the q quantile of a histogram in ns, 0 if it is empty. */
+double histogram_quantile(const histogram_t *h, double q);
+
+/* Append the statistics in the Prometheus text format: a summary with
+ * the p50, p90 and p99 of each stage and of the fetches of each station,
+ * the counters, the queues used, and the reports per second since
+ * stats_init(). */
+void stats_prometheus(outbuf_t *ob);
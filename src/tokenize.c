@@ -0,0 +1,303 @@
+/*
+  tokenize.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "tokenize.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TOKENIZE_X86
+#include <immintrin.h>
+#endif
+
+/* the text is classified 64 bytes at a time into bit masks, bit i standing
+ * for byte i of the block */
+#define BLOCK 64
+
+
+typedef struct {
+  uint64_t delim;	// ' ' or '\n'
+  uint64_t newline;
+  uint64_t upper;	// A-Z
+  uint64_t slash;	// '/'
+} masks_t;
+
+typedef void (*classify_fn)(const char *p, masks_t *m);
+
+
+/* byte classes of the scalar classifier, in the order of masks_t */
+enum { C_DELIM, C_NEWLINE, C_UPPER, C_SLASH };
+
+#define C(c) (1 << (c))
+
+static const unsigned char classes[256] = {
+  ['\n'] = C(C_DELIM) | C(C_NEWLINE), [' '] = C(C_DELIM),
+  ['/'] = C(C_SLASH), ['A' ... 'Z'] = C(C_UPPER)
+};
+
+/* hints from the first and the last byte of a token */
+static const unsigned char first_hints[256] = {
+  ['0' ... '9'] = TOKEN_DIGIT1, ['Q'] = TOKEN_QA, ['A'] = TOKEN_QA
+};
+
+static const unsigned char last_hints[256] = {
+  ['Z'] = TOKEN_Z, ['T'] = TOKEN_WIND, ['S'] = TOKEN_WIND
+};
+
+static void classify_scalar(const char *p, masks_t *m) {
+  uint64_t masks[4] = { 0 };
+  unsigned int c;
+  int i, j;
+
+  for (i = 0; i < BLOCK; i++) {
+    c = classes[(unsigned char)p[i]];
+    for (j = 0; c; j++, c >>= 1)
+      masks[j] |= (uint64_t)(c & 1) << i;
+  }
+  m->delim = masks[C_DELIM];
+  m->newline = masks[C_NEWLINE];
+  m->upper = masks[C_UPPER];
+  m->slash = masks[C_SLASH];
+}
+
+
+#ifdef TOKENIZE_X86
+
+/* bytes in [lo,hi]; the signed compares work for ASCII ranges, bytes over
+ * 0x7f compare as negative and fall outside */
+#define IN_RANGE_SSE2(v, lo, hi) \
+  _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), \
+		_mm_cmplt_epi8(v, _mm_set1_epi8((hi) + 1)))
+#define EQ_SSE2(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define MASK_SSE2(x) (uint64_t)(uint16_t)_mm_movemask_epi8(x)
+
+__attribute__((target("sse2")))
+static void classify_sse2(const char *p, masks_t *m) {
+  masks_t r;
+  __m128i v;
+  int i;
+
+  memset(&r, 0x0, sizeof(r));
+  for (i = 0; i < BLOCK; i += 16) {
+    v = _mm_loadu_si128((const __m128i *)(p + i));
+    r.newline |= MASK_SSE2(EQ_SSE2(v, '\n')) << i;
+    r.delim |= MASK_SSE2(EQ_SSE2(v, ' ')) << i;
+    r.upper |= MASK_SSE2(IN_RANGE_SSE2(v, 'A', 'Z')) << i;
+    r.slash |= MASK_SSE2(EQ_SSE2(v, '/')) << i;
+  }
+  r.delim |= r.newline;
+  *m = r;
+}
+
+
+#define IN_RANGE_AVX2(v, lo, hi) \
+  _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(hi)), \
+		      _mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)))
+#define EQ_AVX2(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define MASK_AVX2(x) (uint64_t)(uint32_t)_mm256_movemask_epi8(x)
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char *p, masks_t *m) {
+  masks_t r;
+  __m256i v;
+  int i;
+
+  memset(&r, 0x0, sizeof(r));
+  for (i = 0; i < BLOCK; i += 32) {
+    v = _mm256_loadu_si256((const __m256i *)(p + i));
+    r.newline |= MASK_AVX2(EQ_AVX2(v, '\n')) << i;
+    r.delim |= MASK_AVX2(EQ_AVX2(v, ' ')) << i;
+    r.upper |= MASK_AVX2(IN_RANGE_AVX2(v, 'A', 'Z')) << i;
+    r.slash |= MASK_AVX2(EQ_AVX2(v, '/')) << i;
+  }
+  r.delim |= r.newline;
+  *m = r;
+}
+
+#endif /* TOKENIZE_X86 */
+
+
+static const struct {
+  const char *name;
+  classify_fn classify;
+} impls[] = {
+#ifdef TOKENIZE_X86
+  { "avx2", classify_avx2 },
+  { "sse2", classify_sse2 },
+#endif
+  { "scalar", classify_scalar }
+};
+
+#define NIMPLS (int)(sizeof(impls) / sizeof(impls[0]))
+
+/* the implementation in use, chosen on first use */
+static int impl = -1;
+
+
+/* is the implementation supported by this CPU */
+static int supported(int i) {
+#ifdef TOKENIZE_X86
+  if (impls[i].classify == classify_avx2)
+    return __builtin_cpu_supports("avx2");
+  if (impls[i].classify == classify_sse2)
+    return __builtin_cpu_supports("sse2");
+#endif
+  return 1;
+}
+
+
+/* PUBLIC--
+ * Select the implementation.
+ */
+int metar_tokenize_use(const char *name) {
+  int i;
+
+  for (i = 0; i < NIMPLS; i++) {
+    if (name && strcmp(name, impls[i].name)) continue;
+    if (supported(i)) {
+      __atomic_store_n(&impl, i, __ATOMIC_RELAXED);
+      return 0;
+    }
+    if (name) break;
+  }
+  return 1;
+} // metar_tokenize_use
+
+
+/* the implementation in use, selected on first use; threads decoding at
+ * once may each select it, and all select the same one */
+static int current(void) {
+  int i = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+
+  if (i < 0) {
+    metar_tokenize_use(NULL);
+    i = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+  }
+  return i;
+}
+
+
+/* PUBLIC--
+ * Name of the implementation in use.
+ */
+const char *metar_tokenize_name(void) {
+  return impls[current()].name;
+} // metar_tokenize_name
+
+
+/* bits below n, 0 < n <= BLOCK */
+static inline uint64_t below(int n) {
+  return ((uint64_t)2 << (n - 1)) - 1;
+}
+
+
+/* PUBLIC--
+ * Split a report into tokens and classify them. All hints come from the
+ * masks, as single bits at the first byte, at the delimiter after the last
+ * byte, or anywhere in between, so there are no branches per token.
+ */
+size_t metar_tokenize(const char *p, size_t len, metar_token_t *tokens,
+		      int max, int *ntokens, int *done) {
+  char pad[BLOCK];
+  classify_fn classify;
+  masks_t m;
+  size_t base, start = 0, size;
+  uint64_t prev, starts, ends, notupper, rm;
+  int n = 0, intoken = 0, from, cut = BLOCK, i;
+  unsigned int flags = 0;
+
+  classify = impls[current()].classify;
+  *done = 0;
+
+  for (base = 0; ; base += BLOCK) {
+    /* the last partial block is read from a copy, nothing past len is
+       touched; the bytes past len count as newlines */
+    if (base + BLOCK <= len) {
+      classify(p + base, &m);
+    } else {
+      size = len - base;
+      memcpy(pad, p + base, size);
+      classify(pad, &m);
+      rm = size ? ~below(size) : ~(uint64_t)0;
+      m.delim |= rm;
+      m.newline |= rm;
+    }
+
+    /* everything from the first newline on ends the report */
+    if (m.newline) {
+      cut = __builtin_ctzll(m.newline);
+      m.delim |= cut ? ~below(cut) : ~(uint64_t)0;
+    }
+
+    /* tokens start after a delimiter and end at one */
+    prev = (m.delim << 1) | !intoken;
+    starts = ~m.delim & prev;
+    ends = m.delim & ~prev;
+    notupper = ~(m.upper | m.delim);
+
+    /* a token from the previous block ends at the first end, unless it
+       goes on to the next block */
+    if (intoken) {
+      i = ends ? __builtin_ctzll(ends) : BLOCK;
+      rm = i ? below(i) : 0;
+      flags &= ~(((notupper & rm) != 0) * TOKEN_UPPER);
+      flags |= ((m.slash & rm) != 0) * TOKEN_SLASH;
+      if (ends == 0) continue;
+      ends &= ends - 1;
+      tokens[n].start = start;
+      tokens[n].len = base + i - start;
+      tokens[n].hints = flags | last_hints[(unsigned char)p[base + i - 1]];
+      n++;
+      intoken = 0;
+    }
+
+    /* the tokens starting in this block */
+    while (starts) {
+      from = __builtin_ctzll(starts);
+      starts &= starts - 1;
+      if (n == max) {
+	*ntokens = n;
+	return base + from;
+      }
+      start = base + from;
+      i = ends ? __builtin_ctzll(ends) : BLOCK;
+      ends &= ends - 1;
+      rm = below(i) & (~(uint64_t)0 << from);
+      flags = ((notupper & rm) == 0) * TOKEN_UPPER |
+	((m.slash & rm) != 0) * TOKEN_SLASH |
+	first_hints[(unsigned char)p[start]];
+      if (i == BLOCK) {
+	intoken = 1;
+	break;
+      }
+      tokens[n].start = start;
+      tokens[n].len = i - from;
+      tokens[n].hints = flags | last_hints[(unsigned char)p[base + i - 1]];
+      n++;
+    }
+
+    if (cut < BLOCK) {
+      *ntokens = n;
+      *done = 1;
+      return (base + cut < len) ? base + cut + 1 : len;
+    }
+  }
+} // metar_tokenize
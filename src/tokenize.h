@@ -0,0 +1,57 @@
+/*
+  tokenize.h
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* tokens handed out per call of metar_tokenize() by the parser */
+#define TOKEN_MAX 32
+
+/* Class hints of a token. They are cheap necessary conditions of the group
+ * formats, so a group matcher only needs to run when its hint is set. */
+#define TOKEN_UPPER  0x01	// only A-Z: station
+#define TOKEN_SLASH  0x02	// contains '/': temperature
+#define TOKEN_Z      0x04	// ends with Z: day/time
+#define TOKEN_WIND   0x08	// ends with T or S, as KT and MPS do: wind
+#define TOKEN_QA     0x10	// starts with Q or A: pressure
+#define TOKEN_DIGIT1 0x20	// starts with a digit: visibility
+
+/* a token of a report */
+typedef struct {
+  unsigned int start;	// offset from the start of the scanned text
+  unsigned int len;
+  unsigned int hints;	// TOKEN_*
+} metar_token_t;
+
+/* Split the report at p, at most len bytes, into space separated tokens
+ * until the first newline. At most max tokens are stored in tokens and
+ * their number in *ntokens. *done is set when the end of the report has
+ * been reached, otherwise the call should be repeated from the returned
+ * offset. The text is classified a block at a time with SSE2 or AVX2 when
+ * the CPU supports them, with identical results.
+ */
+size_t metar_tokenize(const char *p, size_t len, metar_token_t *tokens,
+		      int max, int *ntokens, int *done);
+
+/* Select the implementation: "scalar", "sse2", "avx2", or NULL for the best
+ * one supported. Returns 1 if it isn't available here.
+ */
+int metar_tokenize_use(const char *name);
+
+/* name of the implementation in use */
+const char *metar_tokenize_name(void);
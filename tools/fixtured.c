@@ -0,0 +1,407 @@
+/*
+  fixtured.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Serves station files over HTTP/1.1 for testing the fetch path offline.
+ *
+ * usage: fixtured [-v] [-a addr] [-p port] [-d dir] [-l ms] [-j ms]
+ *                 [-r rate] [-R ms] [-t rate] [-e rate] [-s seed]
+ *
+ * GET /anything/EFHK.TXT answers with dir/EFHK.TXT. Each response is held
+ * back for the latency plus a uniformly random part of the jitter, and
+ * the stall rate of them for the stall time on top, for a long tail. Of the
+ * responses, the error rate get a 503 and the truncation rate are cut off
+ * half way through the body, after which the connection is closed. The
+ * same seed and request order give the same faults. Connections are kept
+ * alive, ETag and If-None-Match make revalidation work. SIGINT or SIGTERM
+ * stop the server and print counts of the responses to stderr.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define MAXCONN  256
+#define REQSIZE  8192
+#define HDRSIZE  512
+
+/* a client connection with at most one response pending */
+typedef struct {
+  int    fd;
+  char   in[REQSIZE];	// received, not yet answered requests
+  size_t inlen;
+  char  *out;		// the response, NULL when none is pending
+  size_t outlen, outoff;
+  int64_t due;		// monotonic ms the response may be sent at
+  int    close;		// close once the response is sent
+} conn_t;
+
+/* settings */
+static const char *dir = ".";
+static int latency = 0, jitter = 0, stall = 5000, verbose = 0;
+static double truncrate = 0, errrate = 0, stallrate = 0;
+static uint64_t rng = 1;
+
+/* response counts */
+static long nrequests, nok, nnotmod, nnotfound, nerrors, ntruncated;
+static long nstalled;
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void on_signal(int sig) {
+  stop = 1;
+}
+
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* xorshift64*, uniform in [0, 1) */
+static double uniform(void) {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return ((rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/* value of a request header, or NULL */
+static const char *header(const char *req, const char *name, size_t *len) {
+  size_t n = strlen(name);
+  const char *p = req;
+
+  while ((p = strstr(p, "\r\n")) != NULL) {
+    p += 2;
+    if (strncasecmp(p, name, n) || p[n] != ':') continue;
+    p += n + 1;
+    while (*p == ' ' || *p == '\t') p++;
+    *len = strcspn(p, "\r\n");
+    return p;
+  }
+  return NULL;
+}
+
+
+/* a file name which stays inside the directory */
+static int valid_name(const char *name, size_t len) {
+  size_t i;
+
+  if (len == 0 || name[0] == '.') return 0;
+  for (i = 0; i < len; i++)
+    if (!((name[i] >= 'A' && name[i] <= 'Z') ||
+	  (name[i] >= 'a' && name[i] <= 'z') ||
+	  (name[i] >= '0' && name[i] <= '9') ||
+	  name[i] == '.' || name[i] == '_' || name[i] == '-')) return 0;
+  return 1;
+}
+
+
+/* set the response up, status line and headers followed by the body */
+static void respond(conn_t *c, const char *status, const char *etag,
+		    const char *body, size_t bodylen, int head) {
+  char hdr[HDRSIZE];
+  int n;
+
+  n = snprintf(hdr, sizeof(hdr),
+	       "HTTP/1.1 %s\r\nContent-Type: text/plain\r\n"
+	       "Content-Length: %zu\r\n%s%s%s%s\r\n",
+	       status, bodylen,
+	       etag ? "ETag: " : "", etag ? etag : "", etag ? "\r\n" : "",
+	       c->close ? "Connection: close\r\n" : "");
+  if (head) bodylen = 0;
+  c->out = malloc(n + bodylen);
+  if (c->out == NULL) {
+    c->close = 1;
+    c->outlen = 0;
+    return;
+  }
+  memcpy(c->out, hdr, n);
+  memcpy(c->out + n, body, bodylen);
+  c->outlen = n + bodylen;
+  c->outoff = 0;
+
+  /* cut the body off, the client sees a short read */
+  if (bodylen > 1 && uniform() < truncrate) {
+    c->outlen = n + bodylen / 2;
+    c->close = 1;
+    ntruncated++;
+  }
+}
+
+
+/* answer the request at the start of the input, which is req_len long */
+static void handle_request(conn_t *c, size_t reqlen) {
+  char path[HDRSIZE + REQSIZE], etag[64], *body = NULL, *req = c->in;
+  const char *target, *name, *value;
+  size_t len, namelen;
+  struct stat st;
+  int head, fd;
+  ssize_t n;
+
+  nrequests++;
+  req[reqlen - 2] = 0;
+  head = strncmp(req, "HEAD ", 5) == 0;
+  value = header(req, "Connection", &len);
+  c->close = (value && len == 5 && strncasecmp(value, "close", 5) == 0) ||
+    strstr(req, " HTTP/1.0\r\n") != NULL;
+  c->due = now_ms() + latency + (int64_t)(uniform() * jitter);
+  if (uniform() < stallrate) {
+    c->due += stall;
+    nstalled++;
+  }
+
+  if (!head && strncmp(req, "GET ", 4)) {
+    c->close = 1;
+    respond(c, "405 Method Not Allowed", NULL, "", 0, 0);
+    nerrors++;
+    goto log;
+  }
+  if (uniform() < errrate) {
+    respond(c, "503 Service Unavailable", NULL, "", 0, head);
+    nerrors++;
+    goto log;
+  }
+
+  /* the last part of the path, without a query */
+  target = req + (head ? 5 : 4);
+  len = strcspn(target, " ?");
+  for (name = target + len; name > target && name[-1] != '/'; name--);
+  namelen = target + len - name;
+
+  if (!valid_name(name, namelen) ||
+      snprintf(path, sizeof(path), "%s/%.*s", dir, (int)namelen, name) < 0 ||
+      (fd = open(path, O_RDONLY)) < 0) {
+    respond(c, "404 Not Found", NULL, "", 0, head);
+    nnotfound++;
+    goto log;
+  }
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+      (body = malloc(st.st_size + 1)) == NULL ||
+      (n = read(fd, body, st.st_size)) != st.st_size) {
+    close(fd);
+    free(body);
+    respond(c, "500 Internal Server Error", NULL, "", 0, head);
+    nerrors++;
+    goto log;
+  }
+  close(fd);
+
+  snprintf(etag, sizeof(etag), "\"%lx-%lx\"",
+	   (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+  value = header(req, "If-None-Match", &len);
+  if (value && len == strlen(etag) && memcmp(value, etag, len) == 0) {
+    respond(c, "304 Not Modified", etag, "", 0, 1);
+    nnotmod++;
+  } else {
+    respond(c, "200 OK", etag, body, st.st_size, head);
+    nok++;
+  }
+  free(body);
+
+ log:
+  if (verbose)
+    fprintf(stderr, "%.*s %.*s in %d ms\n", (int)strcspn(req, "\r"), req,
+	    3, c->out ? c->out + 9 : "---", (int)(c->due - now_ms()));
+  memmove(c->in, c->in + reqlen, c->inlen - reqlen);
+  c->inlen -= reqlen;
+}
+
+
+/* start on the next request of the connection if it has arrived */
+static void next_request(conn_t *c) {
+  char *end;
+
+  if (c->out || c->fd < 0) return;
+  c->in[c->inlen] = 0;
+  if ((end = strstr(c->in, "\r\n\r\n")) != NULL)
+    handle_request(c, end + 4 - c->in);
+  else if (c->inlen >= REQSIZE - 1)
+    c->close = 1;
+}
+
+
+static void close_conn(conn_t *c) {
+  close(c->fd);
+  free(c->out);
+  c->fd = -1;
+  c->out = NULL;
+}
+
+
+/* listening socket, or -1 */
+static int listen_on(const char *addr, int port) {
+  struct sockaddr_in sa;
+  int fd, on = 1;
+
+  memset(&sa, 0x0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+    fprintf(stderr, "invalid address %s\n", addr);
+    return -1;
+  }
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+      listen(fd, 128)) {
+    perror(addr);
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+
+int main(int argc, char *argv[]) {
+  static conn_t conns[MAXCONN];
+  struct pollfd fds[MAXCONN + 1];
+  conn_t *c, *slot[MAXCONN + 1];
+  const char *addr = "127.0.0.1";
+  int port = 8080, lfd, fd, nfds, timeout, i, opt;
+  int64_t now;
+  ssize_t n;
+
+  while ((opt = getopt(argc, argv, "va:p:d:l:j:r:R:t:e:s:")) != -1) {
+    switch (opt) {
+    case 'v': verbose = 1; break;
+    case 'a': addr = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'd': dir = optarg; break;
+    case 'l': latency = atoi(optarg); break;
+    case 'j': jitter = atoi(optarg); break;
+    case 'r': stallrate = atof(optarg); break;
+    case 'R': stall = atoi(optarg); break;
+    case 't': truncrate = atof(optarg); break;
+    case 'e': errrate = atof(optarg); break;
+    case 's': rng = strtoull(optarg, NULL, 0) | 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-v] [-a addr] [-p port] [-d dir] [-l ms] "
+	      "[-j ms] [-r rate] [-R ms] [-t rate] [-e rate] [-s seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (latency < 0 || jitter < 0 || stall < 0) {
+    fprintf(stderr, "%s: negative latency\n", argv[0]);
+    return 1;
+  }
+
+  if ((lfd = listen_on(addr, port)) < 0) return 1;
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+  for (i = 0; i < MAXCONN; i++) conns[i].fd = -1;
+  if (verbose) fprintf(stderr, "serving %s on %s:%d\n", dir, addr, port);
+
+  while (!stop) {
+    /* wait for input, or output once the response is due */
+    now = now_ms();
+    timeout = -1;
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+    nfds = 1;
+    for (i = 0; i < MAXCONN; i++) {
+      c = &conns[i];
+      if (c->fd < 0) continue;
+      fds[nfds].fd = c->fd;
+      fds[nfds].events = c->inlen < REQSIZE - 1 ? POLLIN : 0;
+      if (c->out && c->due <= now) fds[nfds].events |= POLLOUT;
+      else if (c->out && (timeout < 0 || c->due - now < timeout))
+	timeout = c->due - now;
+      slot[nfds++] = c;
+    }
+    if (poll(fds, nfds, timeout) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    for (i = 1; i < nfds; i++) {
+      c = slot[i];
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+	n = read(c->fd, c->in + c->inlen, REQSIZE - 1 - c->inlen);
+	if (n <= 0) {
+	  if (n < 0 && errno == EAGAIN) continue;
+	  close_conn(c);
+	  continue;
+	}
+	c->inlen += n;
+	next_request(c);
+      }
+      if (c->out && c->due <= now_ms()) {
+	n = write(c->fd, c->out + c->outoff, c->outlen - c->outoff);
+	if (n < 0 && errno != EAGAIN) {
+	  close_conn(c);
+	  continue;
+	}
+	if (n > 0) c->outoff += n;
+	if (c->outoff < c->outlen) continue;
+	free(c->out);
+	c->out = NULL;
+	if (c->close) {
+	  close_conn(c);
+	  continue;
+	}
+	next_request(c);
+      }
+      if (c->close && !c->out) close_conn(c);
+    }
+
+    /* take the new connections which fit in */
+    if (fds[0].revents & POLLIN) {
+      while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+	for (i = 0; i < MAXCONN && conns[i].fd >= 0; i++);
+	if (i == MAXCONN) {
+	  close(fd);
+	  continue;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	memset(&conns[i], 0x0, sizeof(conn_t));
+	conns[i].fd = fd;
+      }
+    }
+  }
+
+  fprintf(stderr, "%ld requests: %ld ok, %ld not modified, %ld not found, "
+	  "%ld errors, %ld truncated, %ld stalled\n", nrequests, nok, nnotmod,
+	  nnotfound, nerrors, ntruncated, nstalled);
+  for (i = 0; i < MAXCONN; i++)
+    if (conns[i].fd >= 0) close_conn(&conns[i]);
+  close(lfd);
+  return 0;
+}
+
+// EOF
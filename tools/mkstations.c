@@ -0,0 +1,302 @@
+/*
+  mkstations.c
+  metar - metar decoder
+  Original author Kees Leune <kees@leune.org> 2004 and 2005
+  Further modified by Antti Louko <antti@may.fi> 2010, 2016
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Compiles the station directory into src/stationtab.h for station.c.
+ *
+ * usage: mkstations stations.txt stationtab.h
+ *
+ * Each line of the input is "ICAO;name;country;latitude;longitude;
+ * elevation", # starts a comment. The stations are placed in a perfect
+ * hash (hash, displace and compress): the keys are split into buckets by
+ * one hash, and for each bucket, largest first, a seed is searched for
+ * which a second hash sends all its keys to free slots.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/station.h"
+
+#define MAXSTATIONS 65535
+#define MAXSEED     65535
+#define LINESIZE    512
+
+typedef struct {
+  char icao[5];
+  char name[128];
+  char country[64];
+  double lat;
+  double lon;
+  int elevation;
+  uint32_t key;
+} entry_t;
+
+static entry_t *entries;
+static int nentries = 0;
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const entry_t *)a)->icao, ((const entry_t *)b)->icao);
+}
+
+
+/* split a line into count fields at ';', returns 1 if there are more or
+   fewer of them */
+static int split(char *line, char **fields, int count) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    fields[i] = line;
+    if ((line = strchr(line, ';')) != NULL) *line++ = 0;
+    else if (i < count - 1) return 1;
+  }
+  return line != NULL;
+}
+
+
+/* an ICAO code in upper case */
+static int valid_icao(const char *s) {
+  int i;
+
+  if (s[0] < 'A' || s[0] > 'Z') return 0;
+  for (i = 1; i < 4; i++)
+    if (!((s[i] >= 'A' && s[i] <= 'Z') || (s[i] >= '0' && s[i] <= '9')))
+      return 0;
+  return s[4] == 0;
+}
+
+
+/* a number with nothing after it */
+static int number(const char *s, double min, double max, double *value) {
+  char *end;
+
+  *value = strtod(s, &end);
+  return end != s && *end == 0 && *value >= min && *value <= max;
+}
+
+
+/* read the stations, returns 1 on an error */
+static int read_stations(const char *path) {
+  char line[LINESIZE], *fields[6];
+  entry_t *e;
+  double elevation;
+  FILE *fp;
+  int lineno = 0, size = 0, res = 0;
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    perror(path);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+    line[strcspn(line, "\r\n")] = 0;
+    if (line[0] == '#' || line[0] == 0) continue;
+    if (nentries == size) {
+      size = size ? size * 2 : 256;
+      entries = realloc(entries, size * sizeof(entry_t));
+    }
+    e = &entries[nentries];
+    if (split(line, fields, 6) || !valid_icao(fields[0]) ||
+	strlen(fields[1]) >= sizeof(e->name) ||
+	strlen(fields[2]) >= sizeof(e->country) ||
+	strpbrk(fields[1], "\"\\") || strpbrk(fields[2], "\"\\") ||
+	!number(fields[3], -90, 90, &e->lat) ||
+	!number(fields[4], -180, 180, &e->lon) ||
+	!number(fields[5], INT16_MIN, INT16_MAX, &elevation)) {
+      fprintf(stderr, "%s:%d: invalid station\n", path, lineno);
+      res = 1;
+      continue;
+    }
+    strcpy(e->icao, fields[0]);
+    strcpy(e->name, fields[1]);
+    strcpy(e->country, fields[2]);
+    e->elevation = elevation;
+    e->key = STATION_KEY(e->icao);
+    if (nentries++ == MAXSTATIONS) {
+      fprintf(stderr, "%s: too many stations\n", path);
+      res = 1;
+      break;
+    }
+  }
+  fclose(fp);
+  return res;
+}
+
+
+/* the smallest power of two at least n */
+static int pow2(int n) {
+  int p = 1;
+
+  while (p < n) p *= 2;
+  return p;
+}
+
+
+static int *order_buckets;
+static int *bucket_sizes;
+
+static int compare_buckets(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+
+  if (bucket_sizes[x] != bucket_sizes[y])
+    return bucket_sizes[y] - bucket_sizes[x];
+  return x - y;
+}
+
+
+/* Build the hash: seeds for nbuckets buckets and the entry + 1 of each
+ * of the nslots slots. Returns 1 if some bucket can't be placed. */
+static int build(int nbuckets, int nslots, uint16_t *seeds, uint16_t *slots) {
+  int *members, *first, i, j, b, k, slot, ok, failed = 0;
+  uint32_t seed;
+
+  bucket_sizes = calloc(nbuckets, sizeof(int));
+  first = calloc(nbuckets + 1, sizeof(int));
+  members = malloc(nentries * sizeof(int));
+  order_buckets = malloc(nbuckets * sizeof(int));
+
+  /* entries grouped by bucket */
+  for (i = 0; i < nentries; i++)
+    bucket_sizes[station_hash(entries[i].key, 0) & (nbuckets - 1)]++;
+  for (b = 0; b < nbuckets; b++) first[b + 1] = first[b] + bucket_sizes[b];
+  memset(order_buckets, 0x0, nbuckets * sizeof(int));
+  for (i = 0; i < nentries; i++) {
+    b = station_hash(entries[i].key, 0) & (nbuckets - 1);
+    members[first[b] + order_buckets[b]++] = i;
+  }
+
+  for (b = 0; b < nbuckets; b++) order_buckets[b] = b;
+  qsort(order_buckets, nbuckets, sizeof(int), compare_buckets);
+
+  memset(seeds, 0x0, nbuckets * sizeof(uint16_t));
+  memset(slots, 0x0, nslots * sizeof(uint16_t));
+  for (k = 0; k < nbuckets && bucket_sizes[order_buckets[k]]; k++) {
+    b = order_buckets[k];
+    for (seed = 1, ok = 0; seed <= MAXSEED && !ok; seed++) {
+      ok = 1;
+      for (i = first[b]; i < first[b + 1] && ok; i++) {
+	slot = station_hash(entries[members[i]].key, seed) & (nslots - 1);
+	if (slots[slot]) ok = 0;
+	for (j = first[b]; j < i && ok; j++)
+	  if ((station_hash(entries[members[j]].key, seed) &
+	       (nslots - 1)) == slot) ok = 0;
+      }
+      if (ok) {
+	seeds[b] = seed;
+	for (i = first[b]; i < first[b + 1]; i++)
+	  slots[station_hash(entries[members[i]].key, seed) & (nslots - 1)] =
+	    members[i] + 1;
+      }
+    }
+    if (!ok) {
+      failed = 1;
+      break;
+    }
+  }
+
+  free(bucket_sizes);
+  free(first);
+  free(members);
+  free(order_buckets);
+  return failed;
+}
+
+
+/* write the table as C */
+static int write_table(const char *path, const char *input, int nbuckets,
+		       int nslots, const uint16_t *seeds,
+		       const uint16_t *slots) {
+  char tmp[1024];
+  FILE *fp;
+  int i;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((fp = fopen(tmp, "w")) == NULL) {
+    perror(tmp);
+    return 1;
+  }
+  fprintf(fp, "/* generated by tools/mkstations from %s, don't edit */\n\n",
+	  input);
+  fprintf(fp, "#define STATION_NBUCKETS %d\n", nbuckets);
+  fprintf(fp, "#define STATION_NSLOTS   %d\n\n", nslots);
+
+  fprintf(fp, "static const station_t stations[%d] = {\n", nentries);
+  for (i = 0; i < nentries; i++)
+    fprintf(fp, "  { 0x%08x, \"%s\", %d, %.4f, %.4f, \"%s\", \"%s\" },\n",
+	    entries[i].key, entries[i].icao, entries[i].elevation,
+	    entries[i].lat, entries[i].lon, entries[i].name,
+	    entries[i].country);
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "static const uint16_t station_seeds[STATION_NBUCKETS] = {");
+  for (i = 0; i < nbuckets; i++)
+    fprintf(fp, "%s%u", i % 12 ? ", " : (i ? ",\n  " : "\n  "), seeds[i]);
+  fprintf(fp, "\n};\n\n");
+
+  fprintf(fp, "static const uint16_t station_slots[STATION_NSLOTS] = {");
+  for (i = 0; i < nslots; i++)
+    fprintf(fp, "%s%u", i % 12 ? ", " : (i ? ",\n  " : "\n  "), slots[i]);
+  fprintf(fp, "\n};\n");
+
+  if (fclose(fp) || rename(tmp, path)) {
+    perror(path);
+    remove(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+  uint16_t *seeds, *slots;
+  int nbuckets, nslots, i;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s stations.txt stationtab.h\n", argv[0]);
+    return 1;
+  }
+  if (read_stations(argv[1])) return 1;
+  if (nentries == 0) {
+    fprintf(stderr, "%s: no stations\n", argv[1]);
+    return 1;
+  }
+
+  qsort(entries, nentries, sizeof(entry_t), compare_entries);
+  for (i = 1; i < nentries; i++)
+    if (entries[i].key == entries[i - 1].key) {
+      fprintf(stderr, "%s: %s listed twice\n", argv[1], entries[i].icao);
+      return 1;
+    }
+
+  /* about four keys per bucket and a load of at most 3/4; the table is
+     grown until every bucket can be placed */
+  nbuckets = pow2((nentries + 3) / 4);
+  for (nslots = pow2(nentries * 4 / 3 + 1); ; nslots *= 2) {
+    seeds = malloc(nbuckets * sizeof(uint16_t));
+    slots = malloc(nslots * sizeof(uint16_t));
+    if (!build(nbuckets, nslots, seeds, slots)) break;
+    free(seeds);
+    free(slots);
+  }
+
+  return write_table(argv[2], argv[1], nbuckets, nslots, seeds, slots);
+}
+
+// EOF